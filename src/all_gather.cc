@@ -6,9 +6,341 @@
 
 #include "all_gather.h"
 
+#include <algorithm>
+
 
 namespace para {
 
+// segment size of the pipelined broadcast
+static size_t bcast_segment_size = BCAST_SEGMENT_SIZE;
+
+static BcastAlgorithm ChooseBcastAlgorithm(size_t total_size, int size) {
+  if (total_size < BCAST_SHORT_MSG_SIZE || size < BCAST_MIN_PROCS) {
+    return BCAST_BINOMIAL;
+  } else if (total_size >= BCAST_LONG_MSG_SIZE && total_size / bcast_segment_size >= size) {
+    return BCAST_PIPELINE;
+  } else {
+    return BCAST_SCATTER_ALLGATHER;
+  }
+}
+
+// Resolve ALLGATHER_AUTO, and replace recursive doubling by Bruck if the
+// communicator size is not a power of two.
+static AllGatherAlgorithm ChooseAllGatherAlgorithm(AllGatherAlgorithm algorithm,
+                                                   size_t total_size, int size) {
+  bool is_pof2 = (size & (size - 1)) == 0;
+  if (algorithm == ALLGATHER_AUTO) {
+    if (total_size < ALLGATHER_LONG_MSG_SIZE && is_pof2) {
+      algorithm = ALLGATHER_RECURSIVE_DOUBLING;
+    } else if (total_size < ALLGATHER_SHORT_MSG_SIZE) {
+      algorithm = ALLGATHER_BRUCK;
+    } else {
+      algorithm = ALLGATHER_RING;
+    }
+  }
+  if (algorithm == ALLGATHER_RECURSIVE_DOUBLING && !is_pof2) {
+    algorithm = ALLGATHER_BRUCK;
+  }
+  return algorithm;
+}
+
+// \brief Extent in bytes of a data type, which is the stride between two
+// consecutive elements of that type in a buffer.
+static int TypeExtent(MPI_Datatype datatype, size_t* type_extent) {
+  ::MPI_Aint lb = 0, extent = 0;
+  int ret_val = ::MPI_Type_get_extent(datatype, &lb, &extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  *type_extent = extent;
+  return MPI_SUCCESS;
+}
+
+// \brief Whether the elements of a data type are laid out without holes, so
+// a buffer of count elements is exactly count * extent bytes of payload.
+static bool IsContiguous(MPI_Datatype datatype) {
+  int type_size = 0;
+  ::MPI_Type_size(datatype, &type_size);
+  ::MPI_Aint lb = 0, extent = 0, true_lb = 0, true_extent = 0;
+  ::MPI_Type_get_extent(datatype, &lb, &extent);
+  ::MPI_Type_get_true_extent(datatype, &true_lb, &true_extent);
+  return true_lb == 0 && lb == 0 && type_size == extent && type_size == true_extent;
+}
+
+// \brief Copy count elements of sendtype into recvbuf as elements of recvtype.
+// Contiguous buffers of the same type are copied with memcpy, others through
+// a message to self so MPI handles the type maps.
+static int LocalCopy(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                     void *recvbuf, int recvcount, MPI_Datatype recvtype) {
+  if (sendtype == recvtype && sendcount == recvcount && IsContiguous(recvtype)) {
+    size_t type_extent = 0;
+    TypeExtent(recvtype, &type_extent);
+    ::memcpy(recvbuf, sendbuf, recvcount * type_extent);
+    return MPI_SUCCESS;
+  }
+
+  ::MPI_Status status;
+  return ::MPI_Sendrecv(sendbuf, sendcount, sendtype, 0, GATHER_TAG,
+                        recvbuf, recvcount, recvtype, 0, GATHER_TAG,
+                        MPI_COMM_SELF, &status);
+}
+
+// \brief Allocate a temp buffer which is able to hold count elements of datatype.
+//
+// \param storage memory of the temp buffer
+// \return address of the first element, which is not storage->data() if the
+// true lower bound of datatype is not 0
+static char* AllocTempBuffer(int count, MPI_Datatype datatype, vector<char>* storage) {
+  ::MPI_Aint lb = 0, extent = 0, true_lb = 0, true_extent = 0;
+  ::MPI_Type_get_extent(datatype, &lb, &extent);
+  ::MPI_Type_get_true_extent(datatype, &true_lb, &true_extent);
+
+  storage->assign(count > 0 ? (count - 1) * extent + true_extent : 0, 0);
+  return storage->data() - true_lb;
+}
+
+// Communicators of the two-level collectives, cached on the parent
+// communicator as an attribute.
+struct NodeComms {
+  // ranks on the same node, and whether it was created here
+  MPI_Comm node_comm = MPI_COMM_NULL;
+  bool owns_node_comm = false;
+  int node_rank = -1;
+  int node_size = 0;
+
+  // node rank 0 of every node, MPI_COMM_NULL on other ranks
+  MPI_Comm leader_comm = MPI_COMM_NULL;
+  int node_index = -1;
+
+  // the following are only filled on leaders
+  int num_nodes = 0;
+  // number of ranks on every node, in leader order
+  vector<int> node_sizes;
+  // parent ranks of node 0, then of node 1 ...
+  vector<int> ranks;
+  // node index of every parent rank
+  vector<int> node_of;
+
+  // window of ALLGATHER_SHARED_MEMORY, created on first use
+  SharedGatherBuffer* shared_buffer = nullptr;
+};
+
+static int node_comms_keyval = MPI_KEYVAL_INVALID;
+
+// Node communicators which hold a shared window. Windows can't be freed once
+// MPI_Finalize has begun tearing down, so they are freed from an attribute on
+// MPI_COMM_SELF, which MPI_Finalize deletes first.
+static vector<NodeComms*> shared_node_comms;
+static int finalize_keyval = MPI_KEYVAL_INVALID;
+
+static int FreeSharedBuffers(MPI_Comm comm, int keyval, void *attribute_val, void *extra_state) {
+  for (auto node_comms : shared_node_comms) {
+    delete node_comms->shared_buffer;
+    node_comms->shared_buffer = nullptr;
+  }
+  shared_node_comms.clear();
+  return MPI_SUCCESS;
+}
+
+static int DeleteNodeComms(MPI_Comm comm, int keyval, void *attribute_val, void *extra_state) {
+  NodeComms* node_comms = static_cast<NodeComms*>(attribute_val);
+  if (node_comms->shared_buffer != nullptr) {
+    shared_node_comms.erase(std::find(shared_node_comms.begin(), shared_node_comms.end(), node_comms));
+    delete node_comms->shared_buffer;
+  }
+  if (node_comms->leader_comm != MPI_COMM_NULL) {
+    ::MPI_Comm_free(&node_comms->leader_comm);
+  }
+  if (node_comms->owns_node_comm) {
+    ::MPI_Comm_free(&node_comms->node_comm);
+  }
+  delete node_comms;
+  return MPI_SUCCESS;
+}
+
+// \brief Build the node and leader communicators of comm and cache them.
+//
+// \param node_comm ranks sharing a node, split by MPI_COMM_TYPE_SHARED if MPI_COMM_NULL
+static int CreateNodeComms(MPI_Comm comm, MPI_Comm node_comm, NodeComms** node_comms) {
+  if (node_comms_keyval == MPI_KEYVAL_INVALID) {
+    ::MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, DeleteNodeComms, &node_comms_keyval, nullptr);
+  }
+
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  NodeComms* nc = new NodeComms();
+  if (node_comm == MPI_COMM_NULL) {
+    int ret_val = ::MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                                        &nc->node_comm);
+    if (ret_val != MPI_SUCCESS) {
+      delete nc;
+      return ret_val;
+    }
+    nc->owns_node_comm = true;
+  } else {
+    nc->node_comm = node_comm;
+  }
+  ::MPI_Comm_rank(nc->node_comm, &nc->node_rank);
+  ::MPI_Comm_size(nc->node_comm, &nc->node_size);
+
+  ::MPI_Comm_split(comm, nc->node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &nc->leader_comm);
+
+  // leaders learn where the ranks of every node are
+  vector<int> node_ranks(nc->node_size, -1);
+  Gather(&rank, 1, MPI_INT, node_ranks.data(), 1, MPI_INT, 0, nc->node_comm);
+  if (nc->leader_comm != MPI_COMM_NULL) {
+    int size;
+    ::MPI_Comm_size(comm, &size);
+    ::MPI_Comm_size(nc->leader_comm, &nc->num_nodes);
+    ::MPI_Comm_rank(nc->leader_comm, &nc->node_index);
+
+    nc->node_sizes.assign(nc->num_nodes, 0);
+    AllGather(&nc->node_size, 1, MPI_INT, nc->node_sizes.data(), 1, MPI_INT, nc->leader_comm,
+              ALLGATHER_BRUCK);
+
+    vector<int> displs(nc->num_nodes, 0);
+    for (int i = 1; i < nc->num_nodes; ++i) {
+      displs[i] = displs[i - 1] + nc->node_sizes[i - 1];
+    }
+    nc->ranks.assign(size, -1);
+    AllGatherv(node_ranks.data(), nc->node_size, MPI_INT, nc->ranks.data(), nc->node_sizes.data(),
+               displs.data(), MPI_INT, nc->leader_comm);
+
+    nc->node_of.assign(size, -1);
+    for (int i = 0; i < nc->num_nodes; ++i) {
+      for (int j = 0; j < nc->node_sizes[i]; ++j) {
+        nc->node_of[nc->ranks[displs[i] + j]] = i;
+      }
+    }
+  }
+
+  // replaces and frees a cached one
+  ::MPI_Comm_set_attr(comm, node_comms_keyval, nc);
+  *node_comms = nc;
+  return MPI_SUCCESS;
+}
+
+static int GetNodeComms(MPI_Comm comm, NodeComms** node_comms) {
+  if (node_comms_keyval != MPI_KEYVAL_INVALID) {
+    int found = 0;
+    ::MPI_Comm_get_attr(comm, node_comms_keyval, node_comms, &found);
+    if (found) {
+      return MPI_SUCCESS;
+    }
+  }
+  return CreateNodeComms(comm, MPI_COMM_NULL, node_comms);
+}
+
+int SetNodeComm(MPI_Comm comm, MPI_Comm node_comm) {
+  NodeComms* node_comms = nullptr;
+  return CreateNodeComms(comm, node_comm, &node_comms);
+}
+
+// Gather to the leader inside every node, all gather the node blocks among
+// leaders, then broadcast the result inside every node. Only leaders talk
+// across nodes, every node sends and receives N bytes.
+static int AllGatherHierarchical(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                                 MPI_Comm comm) {
+  NodeComms* nc = nullptr;
+  int ret_val = GetNodeComms(comm, &nc);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  size_t type_extent = 0;
+  ret_val = TypeExtent(recvtype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  size_t block_size = recvcount * type_extent;
+  bool is_leader = nc->leader_comm != MPI_COMM_NULL;
+
+  vector<char> node_storage;
+  char* node_buf = nullptr;
+  if (is_leader) {
+    node_buf = AllocTempBuffer(recvcount * nc->node_size, recvtype, &node_storage);
+  }
+  ret_val = Gather(sendbuf, sendcount, sendtype, node_buf, recvcount, recvtype, 0, nc->node_comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  if (is_leader) {
+    vector<int> counts(nc->num_nodes, 0), displs(nc->num_nodes, 0);
+    for (int i = 0; i < nc->num_nodes; ++i) {
+      counts[i] = nc->node_sizes[i] * recvcount;
+      displs[i] = i > 0 ? displs[i - 1] + counts[i - 1] : 0;
+    }
+
+    vector<char> all_storage;
+    char* all_buf = AllocTempBuffer(recvcount * size, recvtype, &all_storage);
+    ret_val = AllGatherv(node_buf, counts[nc->node_index], recvtype, all_buf, counts.data(),
+                         displs.data(), recvtype, nc->leader_comm);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+
+    // blocks are in node order, move them to their parent ranks
+    for (int j = 0; j < size; ++j) {
+      ret_val = LocalCopy(all_buf + j * block_size, recvcount, recvtype,
+                          static_cast<char*>(recvbuf) + nc->ranks[j] * block_size, recvcount, recvtype);
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+    }
+  }
+
+  return Bcast(recvbuf, recvcount * size, recvtype, 0, nc->node_comm);
+}
+
+// The root sends the buffer to its node leader, leaders broadcast it among
+// themselves, then every leader broadcasts it inside its node.
+static int BcastHierarchical(void *buffer, int count, MPI_Datatype datatype, int root,
+                             MPI_Comm comm) {
+  NodeComms* nc = nullptr;
+  int ret_val = GetNodeComms(comm, &nc);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  // node rank of root if root is on this node
+  int root_node_rank = MPI_UNDEFINED;
+  ::MPI_Group group, node_group;
+  ::MPI_Comm_group(comm, &group);
+  ::MPI_Comm_group(nc->node_comm, &node_group);
+  ::MPI_Group_translate_ranks(group, 1, &root, node_group, &root_node_rank);
+  ::MPI_Group_free(&node_group);
+  ::MPI_Group_free(&group);
+
+  if (root_node_rank != MPI_UNDEFINED && root_node_rank != 0) {
+    if (rank == root) {
+      ret_val = ::MPI_Send(buffer, count, datatype, 0, BCAST_TAG, nc->node_comm);
+    } else if (nc->node_rank == 0) {
+      ::MPI_Status status;
+      ret_val = ::MPI_Recv(buffer, count, datatype, root_node_rank, BCAST_TAG, nc->node_comm, &status);
+    }
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+
+  if (nc->leader_comm != MPI_COMM_NULL) {
+    ret_val = Bcast(buffer, count, datatype, nc->node_of[root], nc->leader_comm);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+
+  return Bcast(buffer, count, datatype, 0, nc->node_comm);
+}
 
 int Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
             int recvcount, MPI_Datatype recvtype, int root,
@@ -19,28 +351,29 @@ int Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recv
   int size;
   ::MPI_Comm_size(comm, &size);
 
-  size_t type_size = 0;
-  if (recvtype == MPI_INT) {
-    type_size = sizeof(int);
-  } else if (recvtype == MPI_DOUBLE) {
-    type_size = sizeof(double);
-  }else if (recvtype == MPI_CHAR) {
-    type_size = sizeof(char);
-  } else {
-    printf("Data type not support recently\n");
-    return -1;
-  }
-
   int ret_val = 0;
   if (rank == root) {
-    ::memcpy(recvbuf, sendbuf, recvcount * sizeof(recvtype));
+    size_t type_extent = 0;
+    ret_val = TypeExtent(recvtype, &type_extent);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+
+    ret_val = LocalCopy(sendbuf, sendcount, sendtype, (char*)recvbuf + root * recvcount * type_extent,
+                        recvcount, recvtype);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
     //
     // root recv msgs
     //
-    for (int p = 1; p < size; ++p) {
+    for (int p = 0; p < size; ++p) {
+      if (p == root) {
+        continue;
+      }
       ::MPI_Status status;
-      ret_val = ::MPI_Recv((char*)recvbuf + p * recvcount * type_size, recvcount,
-                            recvtype, p, GATHER_TAG, MPI_COMM_WORLD, &status);
+      ret_val = ::MPI_Recv((char*)recvbuf + p * recvcount * type_extent, recvcount,
+                            recvtype, p, GATHER_TAG, comm, &status);
       if (ret_val != MPI_SUCCESS) {
         return ret_val;
       }
@@ -50,12 +383,12 @@ int Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recv
     // others send msgs
     //
     ::MPI_Status status;
-    ret_val = ::MPI_Send(sendbuf, sendcount, sendtype, 0, GATHER_TAG, MPI_COMM_WORLD);
+    ret_val = ::MPI_Send(sendbuf, sendcount, sendtype, root, GATHER_TAG, comm);
   }
   return ret_val;
 }
 
-int Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm) {
+static int BcastLinear(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm) {
   int rank = -1;
   ::MPI_Comm_rank(comm, &rank);
   
@@ -67,9 +400,11 @@ int Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm com
     //
     // root send msgs
     //
-    for (int p = 1; p < size; ++p) {
-      ::MPI_Status status;
-      ret_val = ::MPI_Send(buffer, count, datatype, p, BCAST_TAG, MPI_COMM_WORLD);
+    for (int p = 0; p < size; ++p) {
+      if (p == root) {
+        continue;
+      }
+      ret_val = ::MPI_Send(buffer, count, datatype, p, BCAST_TAG, comm);
       if (ret_val != MPI_SUCCESS) {
         return ret_val;
       }
@@ -80,30 +415,1318 @@ int Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm com
     //
     ::MPI_Status status;
     ret_val = ::MPI_Recv(buffer, count,
-                         datatype, 0, BCAST_TAG, MPI_COMM_WORLD, &status);
+                         datatype, root, BCAST_TAG, comm, &status);
   }
   return ret_val;
 }
 
 
-int AllGather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
-               void *recvbuf, int recvcount, MPI_Datatype recvtype,
-               MPI_Comm comm) {
+// Node with relative rank vr receives the buffer from vr - lowbit(vr), then
+// forwards it to vr + mask for every mask below lowbit(vr).
+static int BcastBinomial(void *buffer, int count, MPI_Datatype datatype, int root,
+                         int rank, int size, MPI_Comm comm) {
+  int relative_rank = (rank - root + size) % size;
+
+  int mask = 1;
+  while (mask < size) {
+    if (relative_rank & mask) {
+      int src = (rank - mask + size) % size;
+      ::MPI_Status status;
+      int ret_val = ::MPI_Recv(buffer, count, datatype, src, BCAST_TAG, comm, &status);
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+      break;
+    }
+    mask <<= 1;
+  }
+
+  mask >>= 1;
+  while (mask > 0) {
+    if (relative_rank + mask < size) {
+      int dst = (rank + mask) % size;
+      int ret_val = ::MPI_Send(buffer, count, datatype, dst, BCAST_TAG, comm);
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+    }
+    mask >>= 1;
+  }
+  return MPI_SUCCESS;
+}
+
+// Number of elements in block i when count elements are cut into blocks of block_count.
+static int BlockCount(int count, int block_count, int i) {
+  int left = count - i * block_count;
+  if (left <= 0) {
+    return 0;
+  }
+  return left < block_count ? left : block_count;
+}
+
+// The buffer is cut into p blocks, block i belongs to the node with relative
+// rank i. Root scatters the blocks along a binomial tree, then the blocks are
+// passed around a ring, so every node sends and receives about 2N bytes.
+static int BcastScatterAllGather(void *buffer, int count, MPI_Datatype datatype, int root,
+                                 int rank, int size, size_t type_extent, MPI_Comm comm) {
+  char* buf = static_cast<char*>(buffer);
+  int relative_rank = (rank - root + size) % size;
+  int block_count = (count + size - 1) / size;
+
+  //
+  // binomial scatter, node vr ends up with blocks [vr, vr + subtree size)
+  //
+  int curr_count = relative_rank == 0 ? count : 0;
+  int mask = 1;
+  while (mask < size) {
+    if (relative_rank & mask) {
+      int src = (rank - mask + size) % size;
+      int recv_count = count - relative_rank * block_count;
+      if (recv_count > 0) {
+        ::MPI_Status status;
+        int ret_val = ::MPI_Recv(buf + relative_rank * block_count * type_extent, recv_count,
+                                 datatype, src, BCAST_TAG, comm, &status);
+        if (ret_val != MPI_SUCCESS) {
+          return ret_val;
+        }
+        ::MPI_Get_count(&status, datatype, &curr_count);
+      }
+      break;
+    }
+    mask <<= 1;
+  }
+
+  mask >>= 1;
+  while (mask > 0) {
+    if (relative_rank + mask < size) {
+      int send_count = curr_count - block_count * mask;
+      if (send_count > 0) {
+        int dst = (rank + mask) % size;
+        int ret_val = ::MPI_Send(buf + (relative_rank + mask) * block_count * type_extent, send_count,
+                                 datatype, dst, BCAST_TAG, comm);
+        if (ret_val != MPI_SUCCESS) {
+          return ret_val;
+        }
+        curr_count -= send_count;
+      }
+    }
+    mask >>= 1;
+  }
+
+  //
+  // ring all gather of the blocks
+  //
+  int right = (rank + 1) % size;
+  int left = (rank - 1 + size) % size;
+  for (int step = 0; step < size - 1; ++step) {
+    int send_block = (relative_rank - step + size) % size;
+    int recv_block = (relative_rank - step - 1 + size) % size;
+
+    ::MPI_Status status;
+    int ret_val = ::MPI_Sendrecv(buf + send_block * block_count * type_extent,
+                                 BlockCount(count, block_count, send_block), datatype,
+                                 right, BCAST_TAG,
+                                 buf + recv_block * block_count * type_extent,
+                                 BlockCount(count, block_count, recv_block), datatype,
+                                 left, BCAST_TAG, comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// Nodes form a chain in relative rank order. The buffer is cut into
+// segments, a node receives segment s+1 while it forwards segment s.
+static int BcastPipeline(void *buffer, int count, MPI_Datatype datatype, int root,
+                         int rank, int size, size_t type_extent, MPI_Comm comm) {
+  char* buf = static_cast<char*>(buffer);
+  int relative_rank = (rank - root + size) % size;
+  int prev = relative_rank == 0 ? MPI_PROC_NULL : (rank - 1 + size) % size;
+  int next = relative_rank == size - 1 ? MPI_PROC_NULL : (rank + 1) % size;
+
+  int segment_count = bcast_segment_size / type_extent;
+  if (segment_count < 1) {
+    segment_count = 1;
+  }
+  int num_segments = (count + segment_count - 1) / segment_count;
+
+  vector<::MPI_Request> send_requests(num_segments, MPI_REQUEST_NULL);
+  ::MPI_Request recv_request = MPI_REQUEST_NULL;
+  if (num_segments > 0) {
+    ::MPI_Irecv(buf, BlockCount(count, segment_count, 0), datatype, prev, BCAST_TAG,
+                comm, &recv_request);
+  }
+
+  for (int s = 0; s < num_segments; ++s) {
+    ::MPI_Status status;
+    int ret_val = ::MPI_Wait(&recv_request, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    if (s + 1 < num_segments) {
+      ::MPI_Irecv(buf + (s + 1) * segment_count * type_extent,
+                  BlockCount(count, segment_count, s + 1), datatype, prev, BCAST_TAG,
+                  comm, &recv_request);
+    }
+
+    ret_val = ::MPI_Isend(buf + s * segment_count * type_extent,
+                          BlockCount(count, segment_count, s), datatype, next, BCAST_TAG,
+                          comm, &send_requests[s]);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+
+  return ::MPI_Waitall(num_segments, send_requests.data(), MPI_STATUSES_IGNORE);
+}
+
+int Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm,
+          BcastAlgorithm algorithm) {
+  if (algorithm == BCAST_LINEAR) {
+    return BcastLinear(buffer, count, datatype, root, comm);
+  } else if (algorithm == BCAST_HIERARCHICAL) {
+    return BcastHierarchical(buffer, count, datatype, root, comm);
+  }
+
   int rank = -1;
   ::MPI_Comm_rank(comm, &rank);
-  
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  if (size == 1) {
+    return MPI_SUCCESS;
+  }
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(datatype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  if (algorithm == BCAST_AUTO) {
+    algorithm = ChooseBcastAlgorithm(count * type_extent, size);
+  }
+
+  switch (algorithm) {
+    case BCAST_BINOMIAL:
+      return BcastBinomial(buffer, count, datatype, root, rank, size, comm);
+    case BCAST_SCATTER_ALLGATHER:
+      return BcastScatterAllGather(buffer, count, datatype, root, rank, size, type_extent, comm);
+    case BCAST_PIPELINE:
+      return BcastPipeline(buffer, count, datatype, root, rank, size, type_extent, comm);
+    default:
+      return -1;
+  }
+}
+
+void SetBcastSegmentSize(size_t segment_size) {
+  bcast_segment_size = segment_size > 0 ? segment_size : 1;
+}
+
+size_t GetBcastSegmentSize() {
+  return bcast_segment_size;
+}
+
+SharedGatherBuffer::~SharedGatherBuffer() {
+  Free();
+}
+
+int SharedGatherBuffer::Free() {
+  if (win == MPI_WIN_NULL) {
+    return MPI_SUCCESS;
+  }
+  ::MPI_Win_unlock_all(win);
+  int ret_val = ::MPI_Win_free(&win);
+  comm = MPI_COMM_NULL;
+  capacity = 0;
+  base = nullptr;
+  return ret_val;
+}
+
+int SharedGatherBuffer::Reserve(MPI_Comm comm_, size_t size) {
+  if (win != MPI_WIN_NULL && comm == comm_ && capacity >= size) {
+    return MPI_SUCCESS;
+  }
+  int ret_val = Free();
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  int rank = -1;
+  ::MPI_Comm_rank(comm_, &rank);
+
+  // rank 0 allocates the whole window, so it is one contiguous buffer
+  ::MPI_Aint local_size = rank == 0 ? size : 0;
+  ret_val = ::MPI_Win_allocate_shared(local_size, 1, MPI_INFO_NULL, comm_, &base, &win);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  ::MPI_Aint query_size = 0;
+  int disp_unit = 0;
+  ::MPI_Win_shared_query(win, 0, &query_size, &disp_unit, &base);
+  ::MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+
+  comm = comm_;
+  capacity = size;
+  return MPI_SUCCESS;
+}
+
+int AllGatherShared(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                    int recvcount, MPI_Datatype recvtype, MPI_Comm comm,
+                    SharedGatherBuffer* buffer, const void** recvbuf) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  NodeComms* nc = nullptr;
+  int ret_val = GetNodeComms(comm, &nc);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  if (nc->node_size != size) {
+    return MPI_ERR_COMM;
+  }
+
+  ::MPI_Aint lb = 0, extent = 0, true_lb = 0, true_extent = 0;
+  ::MPI_Type_get_extent(recvtype, &lb, &extent);
+  ::MPI_Type_get_true_extent(recvtype, &true_lb, &true_extent);
+  int count = recvcount * size;
+  ret_val = buffer->Reserve(comm, count > 0 ? (count - 1) * extent + true_extent : 0);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  char* buf = buffer->data() - true_lb;
+
+  // wait until everybody is done with the previous blocks
+  ::MPI_Win_sync(buffer->window());
+  ::MPI_Barrier(comm);
+
+  ret_val = LocalCopy(sendbuf, sendcount, sendtype, buf + rank * recvcount * extent,
+                      recvcount, recvtype);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  // make the blocks of all ranks visible
+  ::MPI_Win_sync(buffer->window());
+  ::MPI_Barrier(comm);
+  ::MPI_Win_sync(buffer->window());
+
+  *recvbuf = buf;
+  return MPI_SUCCESS;
+}
+
+// Gather through the shared window cached on comm, then copy the result out.
+static int AllGatherSharedMemory(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                                 MPI_Comm comm) {
+  NodeComms* nc = nullptr;
+  int ret_val = GetNodeComms(comm, &nc);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  if (nc->shared_buffer == nullptr) {
+    if (finalize_keyval == MPI_KEYVAL_INVALID) {
+      ::MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, FreeSharedBuffers, &finalize_keyval, nullptr);
+      ::MPI_Comm_set_attr(MPI_COMM_SELF, finalize_keyval, nullptr);
+    }
+    nc->shared_buffer = new SharedGatherBuffer();
+    shared_node_comms.emplace_back(nc);
+  }
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  const void* shared = nullptr;
+  ret_val = AllGatherShared(sendbuf, sendcount, sendtype, recvcount, recvtype, comm,
+                            nc->shared_buffer, &shared);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  return LocalCopy(shared, recvcount * size, recvtype, recvbuf, recvcount * size, recvtype);
+}
+
+static int AllGatherGatherBcast(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                                void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                                MPI_Comm comm) {
   int size;
   ::MPI_Comm_size(comm, &size);
 
   int ret_val = 0;
-  ret_val = Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, 0, MPI_COMM_WORLD);
+  ret_val = Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, 0, comm);
   if (ret_val != MPI_SUCCESS) {
     return ret_val;
   }
 
-  ret_val = Bcast(recvbuf, recvcount * size, recvtype, 0, MPI_COMM_WORLD);
+  ret_val = Bcast(recvbuf, recvcount * size, recvtype, 0, comm);
   return ret_val;
 }
 
+// At step s, node r sends block (r - s) to node r+1 and receives
+// block (r - s - 1) from node r-1.
+static int AllGatherRing(void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                         size_t block_size, int rank, int size, MPI_Comm comm) {
+  char* buf = static_cast<char*>(recvbuf);
+  int right = (rank + 1) % size;
+  int left = (rank - 1 + size) % size;
+
+  for (int step = 0; step < size - 1; ++step) {
+    int send_block = (rank - step + size) % size;
+    int recv_block = (rank - step - 1 + size) % size;
+
+    ::MPI_Status status;
+    int ret_val = ::MPI_Sendrecv(buf + send_block * block_size, recvcount, recvtype,
+                                 right, ALLGATHER_TAG,
+                                 buf + recv_block * block_size, recvcount, recvtype,
+                                 left, ALLGATHER_TAG, comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// At step with distance mask, node r exchanges the mask blocks it already
+// holds with node r^mask. The number of blocks doubles every step.
+static int AllGatherRecursiveDoubling(void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                                      size_t block_size, int rank, int size, MPI_Comm comm) {
+  char* buf = static_cast<char*>(recvbuf);
+
+  for (int mask = 1; mask < size; mask <<= 1) {
+    int partner = rank ^ mask;
+    int my_start = rank & ~(mask - 1);
+    int partner_start = partner & ~(mask - 1);
+
+    ::MPI_Status status;
+    int ret_val = ::MPI_Sendrecv(buf + my_start * block_size, mask * recvcount, recvtype,
+                                 partner, ALLGATHER_TAG,
+                                 buf + partner_start * block_size, mask * recvcount, recvtype,
+                                 partner, ALLGATHER_TAG, comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// Blocks are collected in a temp buffer where block i belongs to node
+// (r + i). At step with distance k, node r sends its first min(k, p-k) blocks
+// to node r-k and appends the blocks of node r+k. The temp buffer is rotated
+// into place at the end.
+static int AllGatherBruck(void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                          size_t block_size, int rank, int size, MPI_Comm comm) {
+  char* buf = static_cast<char*>(recvbuf);
+  vector<char> tmp_storage;
+  char* tmp = AllocTempBuffer(recvcount * size, recvtype, &tmp_storage);
+  int ret_val = LocalCopy(buf + rank * block_size, recvcount, recvtype, tmp, recvcount, recvtype);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  for (int k = 1; k < size; k <<= 1) {
+    int num_blocks = k < size - k ? k : size - k;
+    int dst = (rank - k + size) % size;
+    int src = (rank + k) % size;
+
+    ::MPI_Status status;
+    ret_val = ::MPI_Sendrecv(tmp, num_blocks * recvcount, recvtype,
+                             dst, ALLGATHER_TAG,
+                             tmp + k * block_size, num_blocks * recvcount, recvtype,
+                             src, ALLGATHER_TAG, comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+
+  for (int i = 0; i < size; ++i) {
+    ret_val = LocalCopy(tmp + i * block_size, recvcount, recvtype,
+                        buf + ((rank + i) % size) * block_size, recvcount, recvtype);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+int AllGather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype,
+               MPI_Comm comm, AllGatherAlgorithm algorithm) {
+  if (algorithm == ALLGATHER_GATHER_BCAST) {
+    return AllGatherGatherBcast(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+  } else if (algorithm == ALLGATHER_HIERARCHICAL) {
+    return AllGatherHierarchical(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+  }
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  if (algorithm == ALLGATHER_AUTO && size > 1) {
+    NodeComms* nc = nullptr;
+    int ret_val = GetNodeComms(comm, &nc);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    if (nc->node_size == size) {
+      algorithm = ALLGATHER_SHARED_MEMORY;
+    }
+  }
+  if (algorithm == ALLGATHER_SHARED_MEMORY) {
+    return AllGatherSharedMemory(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+  }
+
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(recvtype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  size_t block_size = recvcount * type_extent;
+
+  // own block
+  ret_val = LocalCopy(sendbuf, sendcount, sendtype, static_cast<char*>(recvbuf) + rank * block_size,
+                      recvcount, recvtype);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  if (size == 1) {
+    return MPI_SUCCESS;
+  }
+
+  algorithm = ChooseAllGatherAlgorithm(algorithm, block_size * size, size);
+
+  switch (algorithm) {
+    case ALLGATHER_RING:
+      return AllGatherRing(recvbuf, recvcount, recvtype, block_size, rank, size, comm);
+    case ALLGATHER_RECURSIVE_DOUBLING:
+      return AllGatherRecursiveDoubling(recvbuf, recvcount, recvtype, block_size, rank, size, comm);
+    case ALLGATHER_BRUCK:
+      return AllGatherBruck(recvbuf, recvcount, recvtype, block_size, rank, size, comm);
+    default:
+      return -1;
+  }
+}
+
+// Binomial gather of blocks with different sizes. Node i contributes
+// counts[i] elements of datatype. A node packs the blocks of its subtree,
+// which are the nodes with relative ranks [vr, vr + subtree size), one after
+// another and sends them to its parent in a single message. On exit packed
+// points to the packed blocks of the subtree, for root that is all blocks in
+// relative rank order.
+static int GatherPacked(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                        const int *counts, MPI_Datatype datatype, int root, int rank, int size,
+                        MPI_Comm comm, vector<char>* storage, char** packed) {
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(datatype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  int relative_rank = (rank - root + size) % size;
+  int subtree_size = size - relative_rank;
+  if (relative_rank > 0 && (relative_rank & -relative_rank) < subtree_size) {
+    subtree_size = relative_rank & -relative_rank;
+  }
+
+  // offsets[j] is the offset of relative rank vr + j inside the packed buffer
+  vector<int> offsets(subtree_size + 1, 0);
+  for (int j = 0; j < subtree_size; ++j) {
+    offsets[j + 1] = offsets[j] + counts[(relative_rank + j + root) % size];
+  }
+
+  *packed = AllocTempBuffer(offsets[subtree_size], datatype, storage);
+  ret_val = LocalCopy(sendbuf, sendcount, sendtype, *packed, counts[rank], datatype);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  for (int mask = 1; mask < size; mask <<= 1) {
+    if (relative_rank & mask) {
+      int dst = (rank - mask + size) % size;
+      return ::MPI_Send(*packed, offsets[subtree_size], datatype, dst, GATHER_TAG, comm);
+    }
+    if (mask < subtree_size) {
+      int src = (rank + mask) % size;
+      int end = 2 * mask < subtree_size ? 2 * mask : subtree_size;
+      ::MPI_Status status;
+      ret_val = ::MPI_Recv(*packed + offsets[mask] * type_extent, offsets[end] - offsets[mask],
+                           datatype, src, GATHER_TAG, comm, &status);
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+int Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+            const int *recvcounts, const int *displs, MPI_Datatype recvtype, int root,
+            MPI_Comm comm) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  //
+  // exchange counts, so every node knows the size of its subtree
+  //
+  vector<int> counts(size, 0);
+  int ret_val = AllGather(&sendcount, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  vector<char> storage;
+  char* packed = nullptr;
+  ret_val = GatherPacked(sendbuf, sendcount, sendtype, counts.data(), sendtype, root, rank, size,
+                         comm, &storage, &packed);
+  if (ret_val != MPI_SUCCESS || rank != root) {
+    return ret_val;
+  }
+
+  //
+  // root moves the packed blocks to their displacements
+  //
+  size_t send_extent = 0, recv_extent = 0;
+  TypeExtent(sendtype, &send_extent);
+  TypeExtent(recvtype, &recv_extent);
+  size_t offset = 0;
+  for (int j = 0; j < size; ++j) {
+    int p = (j + root) % size;
+    ret_val = LocalCopy(packed + offset * send_extent, counts[p], sendtype,
+                        static_cast<char*>(recvbuf) + displs[p] * recv_extent, recvcounts[p], recvtype);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    offset += counts[p];
+  }
+  return MPI_SUCCESS;
+}
+
+// Ring over blocks with different sizes, each block goes straight to its
+// displacement.
+static int AllGathervRing(void *recvbuf, const int *recvcounts, const int *displs,
+                          MPI_Datatype recvtype, size_t type_extent, int rank, int size,
+                          MPI_Comm comm) {
+  char* buf = static_cast<char*>(recvbuf);
+  int right = (rank + 1) % size;
+  int left = (rank - 1 + size) % size;
+
+  for (int step = 0; step < size - 1; ++step) {
+    int send_block = (rank - step + size) % size;
+    int recv_block = (rank - step - 1 + size) % size;
+
+    ::MPI_Status status;
+    int ret_val = ::MPI_Sendrecv(buf + displs[send_block] * type_extent, recvcounts[send_block],
+                                 recvtype, right, ALLGATHER_TAG,
+                                 buf + displs[recv_block] * type_extent, recvcounts[recv_block],
+                                 recvtype, left, ALLGATHER_TAG, comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// Binomial gather of the packed blocks to node 0, binomial broadcast of the
+// packed buffer, then every node moves the blocks to their displacements.
+static int AllGathervTree(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                          void *recvbuf, const int *recvcounts, const int *displs,
+                          MPI_Datatype recvtype, size_t type_extent, int rank, int size,
+                          MPI_Comm comm) {
+  vector<char> storage;
+  char* packed = nullptr;
+  int ret_val = GatherPacked(sendbuf, sendcount, sendtype, recvcounts, recvtype, 0, rank, size,
+                             comm, &storage, &packed);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  int total_count = 0;
+  for (int p = 0; p < size; ++p) {
+    total_count += recvcounts[p];
+  }
+  if (rank != 0) {
+    packed = AllocTempBuffer(total_count, recvtype, &storage);
+  }
+  ret_val = Bcast(packed, total_count, recvtype, 0, comm, BCAST_BINOMIAL);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  size_t offset = 0;
+  for (int p = 0; p < size; ++p) {
+    ret_val = LocalCopy(packed + offset * type_extent, recvcounts[p], recvtype,
+                        static_cast<char*>(recvbuf) + displs[p] * type_extent, recvcounts[p], recvtype);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    offset += recvcounts[p];
+  }
+  return MPI_SUCCESS;
+}
+
+int AllGatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+               const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+               MPI_Comm comm, AllGatherAlgorithm algorithm) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(recvtype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  if (algorithm == ALLGATHER_AUTO) {
+    size_t total_size = 0;
+    for (int p = 0; p < size; ++p) {
+      total_size += recvcounts[p] * type_extent;
+    }
+    algorithm = total_size < ALLGATHER_SHORT_MSG_SIZE ? ALLGATHER_GATHER_BCAST : ALLGATHER_RING;
+  }
+
+  if (algorithm != ALLGATHER_RING) {
+    return AllGathervTree(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype,
+                          type_extent, rank, size, comm);
+  }
+
+  // own block
+  ret_val = LocalCopy(sendbuf, sendcount, sendtype,
+                      static_cast<char*>(recvbuf) + displs[rank] * type_extent,
+                      recvcounts[rank], recvtype);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  return AllGathervRing(recvbuf, recvcounts, displs, recvtype, type_extent, rank, size, comm);
+}
+
+template <typename T>
+static void ReduceLoop(const T *in, T *inout, int count, MPI_Op op) {
+  if (op == MPI_SUM) {
+    for (int i = 0; i < count; ++i) {
+      inout[i] += in[i];
+    }
+  } else if (op == MPI_MAX) {
+    for (int i = 0; i < count; ++i) {
+      inout[i] = in[i] > inout[i] ? in[i] : inout[i];
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      inout[i] = in[i] < inout[i] ? in[i] : inout[i];
+    }
+  }
+}
+
+// \brief inout = in op inout, element by element.
+static int ReduceLocal(const void *in, void *inout, int count, MPI_Datatype datatype, MPI_Op op) {
+  if (op == MPI_SUM || op == MPI_MAX || op == MPI_MIN) {
+    if (datatype == MPI_INT) {
+      ReduceLoop(static_cast<const int*>(in), static_cast<int*>(inout), count, op);
+      return MPI_SUCCESS;
+    } else if (datatype == MPI_DOUBLE) {
+      ReduceLoop(static_cast<const double*>(in), static_cast<double*>(inout), count, op);
+      return MPI_SUCCESS;
+    }
+  }
+  return ::MPI_Reduce_local(in, inout, count, datatype, op);
+}
+
+// Let pof2 be the largest power of two not above p and rem = p - pof2. Among
+// the first 2 * rem nodes, every even node sends its whole buffer to the next
+// node and sits out, so pof2 nodes are left. They are renumbered 0..pof2-1,
+// new rank n is node 2n+1 if n < rem and node n+rem otherwise.
+//
+// \param new_rank new rank of this node, -1 if it sits out
+static int FoldToPowerOfTwo(char *buf, int count, MPI_Datatype datatype, MPI_Op op,
+                            int rank, int size, int tag, MPI_Comm comm,
+                            int *pof2, int *rem, int *new_rank) {
+  *pof2 = 1;
+  while (*pof2 * 2 <= size) {
+    *pof2 *= 2;
+  }
+  *rem = size - *pof2;
+
+  if (rank >= 2 * *rem) {
+    *new_rank = rank - *rem;
+    return MPI_SUCCESS;
+  }
+  if (rank % 2 == 0) {
+    *new_rank = -1;
+    return ::MPI_Send(buf, count, datatype, rank + 1, tag, comm);
+  }
+
+  *new_rank = rank / 2;
+  vector<char> tmp_storage;
+  char* tmp = AllocTempBuffer(count, datatype, &tmp_storage);
+  ::MPI_Status status;
+  int ret_val = ::MPI_Recv(tmp, count, datatype, rank - 1, tag, comm, &status);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  return ReduceLocal(tmp, buf, count, datatype, op);
+}
+
+static int OldRank(int new_rank, int rem) {
+  return new_rank < rem ? 2 * new_rank + 1 : new_rank + rem;
+}
+
+// At step s, node r sends partial block (r - s - 1) to node r+1, receives
+// partial block (r - s - 2) from node r-1 and adds its own contribution.
+// After p-1 steps block r of buf holds the result.
+static int ReduceScatterRing(char *buf, const int *counts, const int *displs,
+                             MPI_Datatype datatype, MPI_Op op, size_t type_extent,
+                             int rank, int size, int tag, MPI_Comm comm) {
+  int right = (rank + 1) % size;
+  int left = (rank - 1 + size) % size;
+
+  int max_count = 0;
+  for (int p = 0; p < size; ++p) {
+    max_count = counts[p] > max_count ? counts[p] : max_count;
+  }
+  vector<char> tmp_storage;
+  char* tmp = AllocTempBuffer(max_count, datatype, &tmp_storage);
+
+  for (int step = 0; step < size - 1; ++step) {
+    int send_block = (rank - step - 1 + size) % size;
+    int recv_block = (rank - step - 2 + 2 * size) % size;
+
+    ::MPI_Status status;
+    int ret_val = ::MPI_Sendrecv(buf + displs[send_block] * type_extent, counts[send_block],
+                                 datatype, right, tag,
+                                 tmp, counts[recv_block], datatype, left, tag, comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    ret_val = ReduceLocal(tmp, buf + displs[recv_block] * type_extent, counts[recv_block],
+                          datatype, op);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// Node n of the pof2 folded nodes keeps the half of its range of blocks on
+// its side of n ^ mask and sends the other half to n ^ mask, starting with
+// mask = pof2/2. After log(pof2) steps only block n is left, which holds the
+// result of old ranks 2n and 2n+1 if n < rem.
+static int ReduceScatterRecursiveHalving(char *buf, const int *recvcounts, MPI_Datatype datatype,
+                                         MPI_Op op, size_t type_extent, int rank, int size,
+                                         MPI_Comm comm, int *new_rank, int *rem) {
+  int total_count = 0;
+  for (int p = 0; p < size; ++p) {
+    total_count += recvcounts[p];
+  }
+  int pof2 = 0;
+  int ret_val = FoldToPowerOfTwo(buf, total_count, datatype, op, rank, size, REDUCESCATTER_TAG,
+                                 comm, &pof2, rem, new_rank);
+  if (ret_val != MPI_SUCCESS || *new_rank < 0) {
+    return ret_val;
+  }
+
+  // new_displs[n] is the first element of new block n
+  vector<int> new_displs(pof2 + 1, 0);
+  for (int n = 0; n < pof2; ++n) {
+    int count = recvcounts[OldRank(n, *rem)] + (n < *rem ? recvcounts[2 * n] : 0);
+    new_displs[n + 1] = new_displs[n] + count;
+  }
+
+  vector<char> tmp_storage;
+  char* tmp = AllocTempBuffer(total_count, datatype, &tmp_storage);
+  int low = 0, high = pof2;
+  for (int mask = pof2 / 2; mask > 0; mask /= 2) {
+    int partner = OldRank(*new_rank ^ mask, *rem);
+    int mid = low + mask;
+    int keep_low = *new_rank < mid ? low : mid;
+    int keep_high = *new_rank < mid ? mid : high;
+    int send_low = *new_rank < mid ? mid : low;
+    int send_high = *new_rank < mid ? high : mid;
+    int keep_count = new_displs[keep_high] - new_displs[keep_low];
+
+    ::MPI_Status status;
+    ret_val = ::MPI_Sendrecv(buf + new_displs[send_low] * type_extent,
+                             new_displs[send_high] - new_displs[send_low], datatype,
+                             partner, REDUCESCATTER_TAG,
+                             tmp, keep_count, datatype, partner, REDUCESCATTER_TAG,
+                             comm, &status);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    ret_val = ReduceLocal(tmp, buf + new_displs[keep_low] * type_extent, keep_count,
+                          datatype, op);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    low = keep_low;
+    high = keep_high;
+  }
+  return MPI_SUCCESS;
+}
+
+// Recursive doubling over the folded nodes, then the result is sent back to
+// the nodes which sat out.
+static int AllReduceRecursiveDoubling(char *buf, int count, MPI_Datatype datatype, MPI_Op op,
+                                      int rank, int size, MPI_Comm comm) {
+  int pof2 = 0, rem = 0, new_rank = -1;
+  int ret_val = FoldToPowerOfTwo(buf, count, datatype, op, rank, size, ALLREDUCE_TAG, comm,
+                                 &pof2, &rem, &new_rank);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  if (new_rank >= 0) {
+    vector<char> tmp_storage;
+    char* tmp = AllocTempBuffer(count, datatype, &tmp_storage);
+    for (int mask = 1; mask < pof2; mask <<= 1) {
+      int partner = OldRank(new_rank ^ mask, rem);
+
+      ::MPI_Status status;
+      ret_val = ::MPI_Sendrecv(buf, count, datatype, partner, ALLREDUCE_TAG,
+                               tmp, count, datatype, partner, ALLREDUCE_TAG, comm, &status);
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+      ret_val = ReduceLocal(tmp, buf, count, datatype, op);
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+    }
+  }
+
+  if (rank < 2 * rem) {
+    ::MPI_Status status;
+    if (rank % 2 == 0) {
+      ret_val = ::MPI_Recv(buf, count, datatype, rank + 1, ALLREDUCE_TAG, comm, &status);
+    } else {
+      ret_val = ::MPI_Send(buf, count, datatype, rank - 1, ALLREDUCE_TAG, comm);
+    }
+  }
+  return ret_val;
+}
+
+int AllReduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op,
+              MPI_Comm comm, AllReduceAlgorithm algorithm) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(datatype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  ret_val = LocalCopy(sendbuf, count, datatype, recvbuf, count, datatype);
+  if (ret_val != MPI_SUCCESS || size == 1) {
+    return ret_val;
+  }
+
+  if (algorithm == ALLREDUCE_AUTO) {
+    algorithm = count * type_extent < ALLREDUCE_SHORT_MSG_SIZE || count < size ?
+                ALLREDUCE_RECURSIVE_DOUBLING : ALLREDUCE_RING;
+  }
+
+  char* buf = static_cast<char*>(recvbuf);
+  if (algorithm == ALLREDUCE_RECURSIVE_DOUBLING) {
+    return AllReduceRecursiveDoubling(buf, count, datatype, op, rank, size, comm);
+  }
+
+  int block_count = (count + size - 1) / size;
+  vector<int> counts(size), displs(size);
+  for (int p = 0; p < size; ++p) {
+    counts[p] = BlockCount(count, block_count, p);
+    displs[p] = counts[p] > 0 ? p * block_count : 0;
+  }
+  ret_val = ReduceScatterRing(buf, counts.data(), displs.data(), datatype, op, type_extent,
+                              rank, size, ALLREDUCE_TAG, comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  return AllGathervRing(buf, counts.data(), displs.data(), datatype, type_extent, rank, size,
+                        comm);
+}
+
+int ReduceScatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                  ReduceScatterAlgorithm algorithm) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(datatype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  vector<int> displs(size, 0);
+  for (int p = 1; p < size; ++p) {
+    displs[p] = displs[p - 1] + recvcounts[p - 1];
+  }
+  int total_count = displs[size - 1] + recvcounts[size - 1];
+
+  // the whole send buffer is reduced in place
+  vector<char> storage;
+  char* buf = AllocTempBuffer(total_count, datatype, &storage);
+  ret_val = LocalCopy(sendbuf, total_count, datatype, buf, total_count, datatype);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  if (algorithm == REDUCESCATTER_AUTO) {
+    bool is_pof2 = (size & (size - 1)) == 0;
+    algorithm = is_pof2 || total_count * type_extent < REDUCESCATTER_LONG_MSG_SIZE ?
+                REDUCESCATTER_RECURSIVE_HALVING : REDUCESCATTER_RING;
+  }
+
+  if (size > 1 && algorithm == REDUCESCATTER_RING) {
+    ret_val = ReduceScatterRing(buf, recvcounts, displs.data(), datatype, op, type_extent,
+                                rank, size, REDUCESCATTER_TAG, comm);
+  } else if (size > 1) {
+    int new_rank = -1, rem = 0;
+    ret_val = ReduceScatterRecursiveHalving(buf, recvcounts, datatype, op, type_extent, rank,
+                                            size, comm, &new_rank, &rem);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+
+    // odd nodes of the folded pairs hand the even node its block
+    if (rank < 2 * rem) {
+      ::MPI_Status status;
+      if (rank % 2 == 0) {
+        ret_val = ::MPI_Recv(buf + displs[rank] * type_extent, recvcounts[rank], datatype,
+                             rank + 1, REDUCESCATTER_TAG, comm, &status);
+      } else {
+        ret_val = ::MPI_Send(buf + displs[rank - 1] * type_extent, recvcounts[rank - 1],
+                             datatype, rank - 1, REDUCESCATTER_TAG, comm);
+      }
+    }
+  }
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  return LocalCopy(buf + displs[rank] * type_extent, recvcounts[rank], datatype,
+                   recvbuf, recvcounts[rank], datatype);
+}
+
+CollRequest::~CollRequest() {
+  Wait();
+}
+
+void CollRequest::Reset(MPI_Comm comm_, int tag_) {
+  comm = comm_;
+  tag = tag_;
+  rounds.clear();
+  requests.clear();
+  current_round = 0;
+  storage.clear();
+}
+
+void CollRequest::AddRound() {
+  rounds.emplace_back();
+}
+
+void CollRequest::AddSend(const void *buf, int count, MPI_Datatype datatype, int dst) {
+  Op op = {OP_SEND, buf, nullptr, count, datatype, dst};
+  rounds.back().emplace_back(op);
+}
+
+void CollRequest::AddRecv(void *buf, int count, MPI_Datatype datatype, int src) {
+  Op op = {OP_RECV, nullptr, buf, count, datatype, src};
+  rounds.back().emplace_back(op);
+}
+
+void CollRequest::AddCopy(const void *src, void *dst, int count, MPI_Datatype datatype) {
+  Op op = {OP_COPY, src, dst, count, datatype, MPI_PROC_NULL};
+  rounds.back().emplace_back(op);
+}
+
+char* CollRequest::AllocTemp(int count, MPI_Datatype datatype) {
+  return AllocTempBuffer(count, datatype, &storage);
+}
+
+int CollRequest::Start() {
+  current_round = 0;
+  requests.clear();
+  if (rounds.empty()) {
+    return MPI_SUCCESS;
+  }
+  return StartRound();
+}
+
+int CollRequest::StartRound() {
+  requests.clear();
+  for (const auto& op : rounds[current_round]) {
+    int ret_val = MPI_SUCCESS;
+    if (op.type == OP_COPY) {
+      ret_val = LocalCopy(op.src, op.count, op.datatype, op.dst, op.count, op.datatype);
+    } else {
+      requests.emplace_back(MPI_REQUEST_NULL);
+      if (op.type == OP_SEND) {
+        ret_val = ::MPI_Isend(op.src, op.count, op.datatype, op.peer, tag, comm, &requests.back());
+      } else {
+        ret_val = ::MPI_Irecv(op.dst, op.count, op.datatype, op.peer, tag, comm, &requests.back());
+      }
+    }
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+int CollRequest::Test(bool* done) {
+  while (current_round < rounds.size()) {
+    int flag = 0;
+    int ret_val = ::MPI_Testall(requests.size(), requests.data(), &flag, MPI_STATUSES_IGNORE);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+    if (!flag) {
+      *done = false;
+      return MPI_SUCCESS;
+    }
+
+    ++current_round;
+    if (current_round < rounds.size()) {
+      ret_val = StartRound();
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+    }
+  }
+  *done = true;
+  return MPI_SUCCESS;
+}
+
+int CollRequest::Wait() {
+  while (current_round < rounds.size()) {
+    int ret_val = ::MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+
+    ++current_round;
+    if (current_round < rounds.size()) {
+      ret_val = StartRound();
+      if (ret_val != MPI_SUCCESS) {
+        return ret_val;
+      }
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+int IAllGather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype,
+               MPI_Comm comm, CollRequest* request, AllGatherAlgorithm algorithm) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(recvtype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  size_t block_size = recvcount * type_extent;
+  char* buf = static_cast<char*>(recvbuf);
+
+  request->Reset(comm, IALLGATHER_TAG);
+
+  // own block
+  ret_val = LocalCopy(sendbuf, sendcount, sendtype, buf + rank * block_size, recvcount, recvtype);
+  if (ret_val != MPI_SUCCESS || size == 1) {
+    return ret_val;
+  }
+
+  if (algorithm == ALLGATHER_GATHER_BCAST || algorithm == ALLGATHER_HIERARCHICAL ||
+      algorithm == ALLGATHER_SHARED_MEMORY) {
+    algorithm = ALLGATHER_RING;
+  }
+  algorithm = ChooseAllGatherAlgorithm(algorithm, block_size * size, size);
+
+  if (algorithm == ALLGATHER_RING) {
+    int right = (rank + 1) % size;
+    int left = (rank - 1 + size) % size;
+    for (int step = 0; step < size - 1; ++step) {
+      int send_block = (rank - step + size) % size;
+      int recv_block = (rank - step - 1 + size) % size;
+      request->AddRound();
+      request->AddSend(buf + send_block * block_size, recvcount, recvtype, right);
+      request->AddRecv(buf + recv_block * block_size, recvcount, recvtype, left);
+    }
+  } else if (algorithm == ALLGATHER_RECURSIVE_DOUBLING) {
+    for (int mask = 1; mask < size; mask <<= 1) {
+      int partner = rank ^ mask;
+      int my_start = rank & ~(mask - 1);
+      int partner_start = partner & ~(mask - 1);
+      request->AddRound();
+      request->AddSend(buf + my_start * block_size, mask * recvcount, recvtype, partner);
+      request->AddRecv(buf + partner_start * block_size, mask * recvcount, recvtype, partner);
+    }
+  } else {
+    char* tmp = request->AllocTemp(recvcount * size, recvtype);
+    request->AddRound();
+    request->AddCopy(buf + rank * block_size, tmp, recvcount, recvtype);
+    for (int k = 1; k < size; k <<= 1) {
+      int num_blocks = k < size - k ? k : size - k;
+      request->AddRound();
+      request->AddSend(tmp, num_blocks * recvcount, recvtype, (rank - k + size) % size);
+      request->AddRecv(tmp + k * block_size, num_blocks * recvcount, recvtype, (rank + k) % size);
+    }
+    request->AddRound();
+    for (int i = 0; i < size; ++i) {
+      request->AddCopy(tmp + i * block_size, buf + ((rank + i) % size) * block_size,
+                       recvcount, recvtype);
+    }
+  }
+  return request->Start();
+}
+
+int IBcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm,
+           CollRequest* request, BcastAlgorithm algorithm) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  int size;
+  ::MPI_Comm_size(comm, &size);
+
+  size_t type_extent = 0;
+  int ret_val = TypeExtent(datatype, &type_extent);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  char* buf = static_cast<char*>(buffer);
+
+  request->Reset(comm, IBCAST_TAG);
+  if (size == 1) {
+    return MPI_SUCCESS;
+  }
+
+  if (algorithm == BCAST_AUTO || algorithm == BCAST_HIERARCHICAL) {
+    algorithm = ChooseBcastAlgorithm(count * type_extent, size);
+  }
+
+  int relative_rank = (rank - root + size) % size;
+  // lowest set bit of the relative rank, which is the distance to the parent
+  // in the binomial tree; for root the smallest power of two not below size
+  int parent_mask = relative_rank & -relative_rank;
+  if (relative_rank == 0) {
+    parent_mask = 1;
+    while (parent_mask < size) {
+      parent_mask <<= 1;
+    }
+  }
+
+  if (algorithm == BCAST_LINEAR) {
+    request->AddRound();
+    if (rank == root) {
+      for (int p = 0; p < size; ++p) {
+        if (p != root) {
+          request->AddSend(buf, count, datatype, p);
+        }
+      }
+    } else {
+      request->AddRecv(buf, count, datatype, root);
+    }
+  } else if (algorithm == BCAST_BINOMIAL) {
+    if (relative_rank != 0) {
+      request->AddRound();
+      request->AddRecv(buf, count, datatype, (rank - parent_mask + size) % size);
+    }
+    request->AddRound();
+    for (int mask = parent_mask >> 1; mask > 0; mask >>= 1) {
+      if (relative_rank + mask < size) {
+        request->AddSend(buf, count, datatype, (rank + mask) % size);
+      }
+    }
+  } else if (algorithm == BCAST_SCATTER_ALLGATHER) {
+    int block_count = (count + size - 1) / size;
+
+    // binomial scatter, a subtree of mask nodes receives blocks [vr, vr + mask)
+    if (relative_rank != 0) {
+      int recv_count = BlockCount(count - relative_rank * block_count, parent_mask * block_count, 0);
+      if (recv_count > 0) {
+        request->AddRound();
+        request->AddRecv(buf + relative_rank * block_count * type_extent, recv_count, datatype,
+                         (rank - parent_mask + size) % size);
+      }
+    }
+    request->AddRound();
+    for (int mask = parent_mask >> 1; mask > 0; mask >>= 1) {
+      if (relative_rank + mask < size) {
+        int child = relative_rank + mask;
+        int send_count = BlockCount(count - child * block_count, mask * block_count, 0);
+        if (send_count > 0) {
+          request->AddSend(buf + child * block_count * type_extent, send_count, datatype,
+                           (rank + mask) % size);
+        }
+      }
+    }
+
+    // ring all gather of the blocks
+    int right = (rank + 1) % size;
+    int left = (rank - 1 + size) % size;
+    for (int step = 0; step < size - 1; ++step) {
+      int send_block = (relative_rank - step + size) % size;
+      int recv_block = (relative_rank - step - 1 + size) % size;
+      request->AddRound();
+      request->AddSend(buf + send_block * block_count * type_extent,
+                       BlockCount(count, block_count, send_block), datatype, right);
+      request->AddRecv(buf + recv_block * block_count * type_extent,
+                       BlockCount(count, block_count, recv_block), datatype, left);
+    }
+  } else if (algorithm == BCAST_PIPELINE) {
+    int segment_count = bcast_segment_size / type_extent;
+    if (segment_count < 1) {
+      segment_count = 1;
+    }
+    int num_segments = (count + segment_count - 1) / segment_count;
+    int prev = (rank - 1 + size) % size;
+    int next = (rank + 1) % size;
+    bool is_last = relative_rank == size - 1;
+
+    // round s receives segment s and forwards segment s - 1
+    for (int s = 0; s <= num_segments; ++s) {
+      request->AddRound();
+      if (relative_rank == 0) {
+        if (s < num_segments) {
+          request->AddSend(buf + s * segment_count * type_extent,
+                           BlockCount(count, segment_count, s), datatype, next);
+        }
+        continue;
+      }
+      if (s < num_segments) {
+        request->AddRecv(buf + s * segment_count * type_extent,
+                         BlockCount(count, segment_count, s), datatype, prev);
+      }
+      if (s > 0 && !is_last) {
+        request->AddSend(buf + (s - 1) * segment_count * type_extent,
+                         BlockCount(count, segment_count, s - 1), datatype, next);
+      }
+    }
+  } else {
+    return -1;
+  }
+  return request->Start();
+}
+
 } // namespace para
 
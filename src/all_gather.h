@@ -24,20 +24,351 @@ namespace para {
 
 const int GATHER_TAG = 10101;
 const int BCAST_TAG = 10102;
+const int ALLGATHER_TAG = 10103;
+const int IALLGATHER_TAG = 10104;
+const int IBCAST_TAG = 10105;
+const int ALLREDUCE_TAG = 10106;
+const int REDUCESCATTER_TAG = 10107;
 
+// Total message size (in bytes) used to choose an all gather algorithm.
+// Below ALLGATHER_SHORT_MSG_SIZE the latency term dominates, above
+// ALLGATHER_LONG_MSG_SIZE the bandwidth term dominates.
+const size_t ALLGATHER_SHORT_MSG_SIZE = 81920;
+const size_t ALLGATHER_LONG_MSG_SIZE = 524288;
+
+// Algorithms used by AllGather.
+//
+// ALLGATHER_AUTO: choose one according to message size and communicator size
+// ALLGATHER_GATHER_BCAST: gather to node 0, then broadcast from node 0
+// ALLGATHER_RING: p-1 steps, every node passes one block to its right neighbour
+// ALLGATHER_RECURSIVE_DOUBLING: log(p) steps, only for power-of-two communicators
+// ALLGATHER_BRUCK: ceil(log(p)) steps, works for any communicator size
+// ALLGATHER_HIERARCHICAL: gather inside every node, all gather among node leaders,
+//                         then broadcast inside every node
+// ALLGATHER_SHARED_MEMORY: every node writes its block into a shared memory
+//                          window, only if all nodes are on one host
+enum AllGatherAlgorithm {
+  ALLGATHER_AUTO = 0,
+  ALLGATHER_GATHER_BCAST,
+  ALLGATHER_RING,
+  ALLGATHER_RECURSIVE_DOUBLING,
+  ALLGATHER_BRUCK,
+  ALLGATHER_HIERARCHICAL,
+  ALLGATHER_SHARED_MEMORY
+};
+
+// Message size (in bytes) and communicator size used to choose a broadcast
+// algorithm. Short messages or small communicators use the binomial tree,
+// long messages use scatter + ring all gather, and messages that split into
+// at least as many segments as there are nodes are pipelined along a chain.
+const size_t BCAST_SHORT_MSG_SIZE = 12288;
+const size_t BCAST_LONG_MSG_SIZE = 524288;
+const int BCAST_MIN_PROCS = 8;
+
+// Default segment size (in bytes) of the pipelined broadcast.
+const size_t BCAST_SEGMENT_SIZE = 131072;
+
+// Algorithms used by Bcast.
+//
+// BCAST_AUTO: choose one according to message size and communicator size
+// BCAST_LINEAR: root sends the whole buffer to every other node
+// BCAST_BINOMIAL: log(p) steps along a binomial tree
+// BCAST_SCATTER_ALLGATHER: binomial scatter followed by a ring all gather (van de Geijn)
+// BCAST_PIPELINE: the buffer is cut into segments which are pipelined along a chain
+// BCAST_HIERARCHICAL: broadcast among node leaders, then inside every node
+enum BcastAlgorithm {
+  BCAST_AUTO = 0,
+  BCAST_LINEAR,
+  BCAST_BINOMIAL,
+  BCAST_SCATTER_ALLGATHER,
+  BCAST_PIPELINE,
+  BCAST_HIERARCHICAL
+};
+
+// Total message size (in bytes) used to choose a reduction algorithm. All
+// reduce uses recursive doubling below ALLREDUCE_SHORT_MSG_SIZE, where the
+// latency term dominates, and the ring otherwise. Reduce scatter uses
+// recursive halving on power-of-two communicators or below
+// REDUCESCATTER_LONG_MSG_SIZE, and the ring otherwise.
+const size_t ALLREDUCE_SHORT_MSG_SIZE = 2048;
+const size_t REDUCESCATTER_LONG_MSG_SIZE = 524288;
+
+// Algorithms used by AllReduce.
+//
+// ALLREDUCE_AUTO: choose one according to message size and communicator size
+// ALLREDUCE_RING: ring reduce scatter followed by a ring all gather, every node
+//                 sends about 2N bytes in 2(p-1) steps
+// ALLREDUCE_RECURSIVE_DOUBLING: log(p) steps exchanging the whole buffer
+enum AllReduceAlgorithm {
+  ALLREDUCE_AUTO = 0,
+  ALLREDUCE_RING,
+  ALLREDUCE_RECURSIVE_DOUBLING
+};
+
+// Algorithms used by ReduceScatter.
+//
+// REDUCESCATTER_AUTO: choose one according to message size and communicator size
+// REDUCESCATTER_RING: p-1 steps, every node passes one partial block to its right neighbour
+// REDUCESCATTER_RECURSIVE_HALVING: log(p) steps, the exchanged half shrinks every step
+enum ReduceScatterAlgorithm {
+  REDUCESCATTER_AUTO = 0,
+  REDUCESCATTER_RING,
+  REDUCESCATTER_RECURSIVE_HALVING
+};
+
+// \brief Group the ranks of comm into nodes for ALLGATHER_HIERARCHICAL and
+// BCAST_HIERARCHICAL.
+//
+// By default comm is split by MPI_Comm_split_type(MPI_COMM_TYPE_SHARED) on the
+// first two-level call, and the node communicators are cached on comm until it
+// is freed. This overrides the grouping, e.g. to group by socket instead. It
+// is collective over comm, and node_comm must outlive comm.
+//
+// \param node_comm sub communicator of comm holding the ranks of this node
+// \return MPI_SUCCESS on success
+int SetNodeComm(MPI_Comm comm, MPI_Comm node_comm);
+
+// \brief Gather blocks from all nodes to root.
+//
+// Any predefined or derived data type is supported, block p is stored at
+// recvbuf + p * recvcount * extent(recvtype).
+//
+// \return MPI_SUCCESS on success
 int Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
            int recvcount, MPI_Datatype recvtype, int root,
            MPI_Comm comm);
 
 
-int Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm);
+// \brief Broadcast a buffer from root to all nodes.
+//
+// By default the binomial tree is used for short messages and small
+// communicators, scatter + ring all gather for long messages and the
+// segmented pipeline for messages of at least one segment per node.
+// BCAST_HIERARCHICAL has to be asked for explicitly.
+// Blocks and segments are cut between elements, so derived data types work as well.
+//
+// \param algorithm algorithm to use, BCAST_AUTO by default
+// \return MPI_SUCCESS on success
+int Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm,
+          BcastAlgorithm algorithm = BCAST_AUTO);
+
+// \brief Set the segment size (in bytes) of the pipelined broadcast.
+// BCAST_SEGMENT_SIZE is used if it is never set.
+void SetBcastSegmentSize(size_t segment_size);
+
+// \return the segment size (in bytes) of the pipelined broadcast
+size_t GetBcastSegmentSize();
 
-// I try to use two steps to implement this method.
-// This first step is gather to node 0, the second step is broadcast from node 0.
-// Recently, only MPI_CHAR, MPI_INT, MPI_DOUBLE are supported.
+// \brief Gather blocks from all nodes and deliver the result to all nodes.
+//
+// By default the algorithm is chosen from the total message size and the
+// communicator size: recursive doubling for short messages on power-of-two
+// communicators, Bruck for short messages otherwise and ring for long messages.
+// Ring, recursive doubling and Bruck move O(N) bytes per node, where N is the
+// size of recvbuf. Forcing ALLGATHER_RECURSIVE_DOUBLING on a communicator whose
+// size is not a power of two falls back to Bruck.
+// ALLGATHER_HIERARCHICAL is never picked automatically. It cuts the traffic
+// between machines by the number of ranks per machine.
+// If all nodes of comm are on one host, ALLGATHER_AUTO uses
+// ALLGATHER_SHARED_MEMORY, which writes every block once into a window shared
+// by the host and copies it out once. The window is cached on comm.
+// Any predefined or derived data type is supported, blocks are laid out by type extent.
+//
+// \param algorithm algorithm to use, ALLGATHER_AUTO by default
+// \return MPI_SUCCESS on success
 int AllGather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
               void *recvbuf, int recvcount, MPI_Datatype recvtype,
-              MPI_Comm comm);
+              MPI_Comm comm, AllGatherAlgorithm algorithm = ALLGATHER_AUTO);
+
+// \brief Gather blocks of different sizes from all nodes to root.
+//
+// Nodes first exchange their counts, then the blocks travel along a binomial
+// tree, packed per subtree, and root moves block p to recvbuf + displs[p] *
+// extent(recvtype). recvcounts and displs are only used at root.
+//
+// \return MPI_SUCCESS on success
+int Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+            const int *recvcounts, const int *displs, MPI_Datatype recvtype, int root,
+            MPI_Comm comm);
+
+// \brief Gather blocks of different sizes from all nodes and deliver the
+// result to all nodes. Block p is stored at recvbuf + displs[p] * extent(recvtype).
+//
+// ALLGATHER_RING passes the blocks around a ring straight into their
+// displacements. The other algorithms gather the packed blocks along a binomial
+// tree and broadcast them back, which takes fewer steps for short messages.
+// ALLGATHER_AUTO chooses between the two by the total message size.
+//
+// \param algorithm algorithm to use, ALLGATHER_AUTO by default
+// \return MPI_SUCCESS on success
+int AllGatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+               const int *recvcounts, const int *displs, MPI_Datatype recvtype,
+               MPI_Comm comm, AllGatherAlgorithm algorithm = ALLGATHER_AUTO);
+
+// \brief Combine the buffers of all nodes with op and deliver the result to
+// all nodes.
+//
+// MPI_SUM, MPI_MAX and MPI_MIN on MPI_INT and MPI_DOUBLE are reduced by
+// inlined loops, other predefined ops and types go through MPI_Reduce_local.
+// op must be commutative. Every node gets bitwise the same result.
+// On communicators whose size is not a power of two, recursive doubling first
+// folds the extra nodes into their neighbours.
+//
+// \param algorithm algorithm to use, ALLREDUCE_AUTO by default
+// \return MPI_SUCCESS on success
+int AllReduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op,
+              MPI_Comm comm, AllReduceAlgorithm algorithm = ALLREDUCE_AUTO);
+
+// \brief Combine the buffers of all nodes with op and scatter the result, node
+// p gets the recvcounts[p] elements following the first
+// recvcounts[0] + ... + recvcounts[p-1] ones.
+//
+// Supports the same ops and types as AllReduce(). On communicators whose size
+// is not a power of two, recursive halving first folds the extra nodes into
+// their neighbours.
+//
+// \param algorithm algorithm to use, REDUCESCATTER_AUTO by default
+// \return MPI_SUCCESS on success
+int ReduceScatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                  ReduceScatterAlgorithm algorithm = REDUCESCATTER_AUTO);
+
+// \brief Memory window shared by all ranks of a communicator on one host,
+// see AllGatherShared().
+class SharedGatherBuffer {
+ public:
+  SharedGatherBuffer() = default;
+  SharedGatherBuffer(const SharedGatherBuffer&) = delete;
+  SharedGatherBuffer& operator=(const SharedGatherBuffer&) = delete;
+
+  // frees the window, so it is collective like Free()
+  ~SharedGatherBuffer();
+
+  // \brief Make sure the window holds at least size bytes. The window is
+  // allocated by MPI_Win_allocate_shared on comm, and reallocated if it is too
+  // small or belongs to another communicator. Collective over comm.
+  //
+  // \return MPI_SUCCESS on success
+  int Reserve(MPI_Comm comm, size_t size);
+
+  // \brief Free the window. Collective over the communicator of the window.
+  int Free();
+
+  // \return start of the window, the same memory on all ranks
+  char* data() const { return base; }
+
+  MPI_Win window() const { return win; }
+
+ private:
+  MPI_Win win = MPI_WIN_NULL;
+  MPI_Comm comm = MPI_COMM_NULL;
+  size_t capacity = 0;
+  char* base = nullptr;
+};
+
+// \brief AllGather without copying the result: every rank writes its block
+// once into a window shared by all ranks, and gets a pointer to the gathered
+// blocks. All ranks of comm must be on one host.
+//
+// The blocks stay valid until the next call with the same buffer, so ranks
+// must be done reading them before calling it again.
+//
+// \param buffer shared window, grown on demand
+// \param recvbuf set to the gathered blocks, block p at p * recvcount * extent(recvtype)
+// \return MPI_SUCCESS on success, MPI_ERR_COMM if comm spans more than one host
+int AllGatherShared(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                    int recvcount, MPI_Datatype recvtype, MPI_Comm comm,
+                    SharedGatherBuffer* buffer, const void** recvbuf);
+
+// \brief Handle of a nonblocking collective, see IAllGather() and IBcast().
+//
+// A nonblocking collective is a schedule of rounds. A round is a set of
+// MPI_Isend, MPI_Irecv and local copies which don't depend on each other; it
+// is started once the previous round has completed. Rounds are started from
+// Test() and Wait(), so call Test() now and then while doing local work.
+//
+// Only one nonblocking collective of each kind may be in flight on a
+// communicator at a time, since their messages share a tag.
+class CollRequest {
+ public:
+  CollRequest() = default;
+  CollRequest(const CollRequest&) = delete;
+  CollRequest& operator=(const CollRequest&) = delete;
+
+  // waits for an unfinished collective
+  ~CollRequest();
+
+  // \brief Progress the collective without blocking.
+  //
+  // \param done set to true once the whole schedule has completed
+  // \return MPI_SUCCESS on success
+  int Test(bool* done);
+
+  // \brief Block until the whole schedule has completed.
+  //
+  // \return MPI_SUCCESS on success
+  int Wait();
+
+  // \brief Clear the schedule, which must not be in flight.
+  void Reset(MPI_Comm comm, int tag);
+
+  // \brief Append an empty round to the schedule.
+  void AddRound();
+
+  // \brief Append an operation to the last round.
+  void AddSend(const void *buf, int count, MPI_Datatype datatype, int dst);
+  void AddRecv(void *buf, int count, MPI_Datatype datatype, int src);
+  void AddCopy(const void *src, void *dst, int count, MPI_Datatype datatype);
+
+  // \brief Temp buffer which lives as long as the schedule.
+  char* AllocTemp(int count, MPI_Datatype datatype);
+
+  // \brief Start the first round.
+  int Start();
+
+ private:
+  enum OpType { OP_SEND, OP_RECV, OP_COPY };
+
+  struct Op {
+    OpType type;
+    const void* src;
+    void* dst;
+    int count;
+    MPI_Datatype datatype;
+    int peer;
+  };
+
+  int StartRound();
+
+  MPI_Comm comm = MPI_COMM_NULL;
+  int tag = 0;
+  vector<vector<Op>> rounds;
+  vector<::MPI_Request> requests;
+  size_t current_round = 0;
+  vector<char> storage;
+};
+
+// \brief Nonblocking AllGather. The blocks move in the background while
+// request->Test() and request->Wait() are called, and recvbuf must not be
+// touched before the request has completed. sendbuf is copied before return.
+//
+// Ring, recursive doubling and Bruck are scheduled, ALLGATHER_GATHER_BCAST
+// ALLGATHER_HIERARCHICAL and ALLGATHER_SHARED_MEMORY fall back to ring.
+//
+// \param request handle of the collective
+// \return MPI_SUCCESS on success
+int IAllGather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype,
+               MPI_Comm comm, CollRequest* request, AllGatherAlgorithm algorithm = ALLGATHER_AUTO);
+
+// \brief Nonblocking Bcast. buffer must not be touched before the request
+// has completed. All broadcast algorithms but BCAST_HIERARCHICAL are
+// scheduled, which is replaced by the automatic choice.
+//
+// \param request handle of the collective
+// \return MPI_SUCCESS on success
+int IBcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm,
+           CollRequest* request, BcastAlgorithm algorithm = BCAST_AUTO);
 
 } // namespace para
 
@@ -7,19 +7,554 @@
 
 #include "all_gather.h"
 
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+struct Particle {
+  double pos;
+  int id;
+  char tag;
+};
+
+void TestAllGather(para::AllGatherAlgorithm algorithm, int count, MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+
+  vector<int> val(count);
+  for (int i = 0; i < count; ++i) {
+    val[i] = (rank + 2) * (9 + rank) + i;
+  }
+  vector<int> arr(count * size, -1);
+
+  auto ret_val = para::AllGather(val.data(), count, MPI_INT, arr.data(), count, MPI_INT,
+                                 comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int p = 0; p < size; ++p) {
+    for (int i = 0; i < count; ++i) {
+      assert(arr[p * count + i] == (p + 2) * (9 + p) + i);
+    }
+  }
+
+  vector<double> val_d(count, rank * 0.5);
+  vector<double> arr_d(count * size, -1.0);
+  ret_val = para::AllGather(val_d.data(), count, MPI_DOUBLE, arr_d.data(), count, MPI_DOUBLE,
+                            comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int p = 0; p < size; ++p) {
+    for (int i = 0; i < count; ++i) {
+      assert(arr_d[p * count + i] == p * 0.5);
+    }
+  }
+}
+
+// MPI_FLOAT, MPI_INT64_T and a struct with padding
+void TestAllGatherTypes(para::AllGatherAlgorithm algorithm) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  const int count = 5;
+  vector<float> val_f(count, rank + 0.25f);
+  vector<float> arr_f(count * size, -1.0f);
+  auto ret_val = para::AllGather(val_f.data(), count, MPI_FLOAT, arr_f.data(), count, MPI_FLOAT,
+                                 MPI_COMM_WORLD, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count * size; ++i) {
+    assert(arr_f[i] == i / count + 0.25f);
+  }
+
+  vector<int64_t> val_l(count, (int64_t(1) << 40) + rank);
+  vector<int64_t> arr_l(count * size, -1);
+  ret_val = para::AllGather(val_l.data(), count, MPI_INT64_T, arr_l.data(), count, MPI_INT64_T,
+                            MPI_COMM_WORLD, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count * size; ++i) {
+    assert(arr_l[i] == (int64_t(1) << 40) + i / count);
+  }
+
+  int block_lengths[] = {1, 1, 1};
+  ::MPI_Aint displs[] = {offsetof(Particle, pos), offsetof(Particle, id), offsetof(Particle, tag)};
+  ::MPI_Datatype types[] = {MPI_DOUBLE, MPI_INT, MPI_CHAR};
+  ::MPI_Datatype struct_type, particle_type;
+  ::MPI_Type_create_struct(3, block_lengths, displs, types, &struct_type);
+  ::MPI_Type_create_resized(struct_type, 0, sizeof(Particle), &particle_type);
+  ::MPI_Type_commit(&particle_type);
+
+  vector<Particle> val_p(count);
+  for (int i = 0; i < count; ++i) {
+    val_p[i].pos = rank * 1.5 + i;
+    val_p[i].id = rank * count + i;
+    val_p[i].tag = 'a' + rank % 26;
+  }
+  vector<Particle> arr_p(count * size);
+  ret_val = para::AllGather(val_p.data(), count, particle_type, arr_p.data(), count, particle_type,
+                            MPI_COMM_WORLD, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count * size; ++i) {
+    int p = i / count;
+    assert(arr_p[i].pos == p * 1.5 + i % count);
+    assert(arr_p[i].id == i);
+    assert(arr_p[i].tag == 'a' + p % 26);
+  }
+
+  ::MPI_Type_free(&particle_type);
+  ::MPI_Type_free(&struct_type);
+}
+
+void TestBcast(para::BcastAlgorithm algorithm, int count, int root, MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank = 0;
+  ::MPI_Comm_rank(comm, &rank);
+
+  vector<int> buf(count, -1);
+  if (rank == root) {
+    for (int i = 0; i < count; ++i) {
+      buf[i] = i * 3 + root;
+    }
+  }
+  auto ret_val = para::Bcast(buf.data(), count, MPI_INT, root, comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(buf[i] == i * 3 + root);
+  }
+}
+
+void TestIAllGather(para::AllGatherAlgorithm algorithm, int count) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  vector<int> val(count, rank * 11);
+  vector<int> arr(count * size, -1);
+  para::CollRequest request;
+  auto ret_val = para::IAllGather(val.data(), count, MPI_INT, arr.data(), count, MPI_INT,
+                                  MPI_COMM_WORLD, &request, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  // sendbuf may be reused right away
+  val.assign(count, -7);
+
+  // overlap with some local work
+  bool done = false;
+  double work = 0.0;
+  while (!done) {
+    for (int i = 0; i < 1000; ++i) {
+      work += i * 0.5;
+    }
+    ret_val = request.Test(&done);
+    assert(ret_val == MPI_SUCCESS);
+  }
+  assert(work > 0.0);
+
+  for (int i = 0; i < count * size; ++i) {
+    assert(arr[i] == (i / count) * 11);
+  }
+}
+
+void TestIBcast(para::BcastAlgorithm algorithm, int count, int root) {
+  int rank = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  vector<double> buf(count, -1.0);
+  if (rank == root) {
+    for (int i = 0; i < count; ++i) {
+      buf[i] = i * 0.25 + root;
+    }
+  }
+  para::CollRequest request;
+  auto ret_val = para::IBcast(buf.data(), count, MPI_DOUBLE, root, MPI_COMM_WORLD, &request, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  ret_val = request.Wait();
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(buf[i] == i * 0.25 + root);
+  }
+}
+
+void TestGather(int root, MPI_Comm comm) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+
+  int val[] = {rank * 2, rank * 2 + 1};
+  vector<int> arr(2 * size, -1);
+  auto ret_val = para::Gather(val, 2, MPI_INT, arr.data(), 2, MPI_INT, root, comm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < 2 * size; ++i) {
+    assert(rank != root || arr[i] == i);
+  }
+}
+
+// collectives on the halves of MPI_COMM_WORLD, with every root
+void TestAllReduce(para::AllReduceAlgorithm algorithm, int count, MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+
+  vector<int> val(count);
+  for (int i = 0; i < count; ++i) {
+    val[i] = 3 * rank + i;
+  }
+  vector<int> res(count, -1);
+  auto ret_val = para::AllReduce(val.data(), res.data(), count, MPI_INT, MPI_SUM, comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(res[i] == 3 * size * (size - 1) / 2 + size * i);
+  }
+  ret_val = para::AllReduce(val.data(), res.data(), count, MPI_INT, MPI_MAX, comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(res[i] == 3 * (size - 1) + i);
+  }
+  ret_val = para::AllReduce(val.data(), res.data(), count, MPI_INT, MPI_MIN, comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(res[i] == i);
+  }
+
+  vector<double> val_d(count, (rank + 1) * 0.5);
+  vector<double> res_d(count, -1.0);
+  ret_val = para::AllReduce(val_d.data(), res_d.data(), count, MPI_DOUBLE, MPI_SUM, comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(res_d[i] == size * (size + 1) * 0.25);
+  }
+
+  // goes through MPI_Reduce_local
+  vector<float> val_f(count, rank + 0.25f);
+  vector<float> res_f(count, -1.0f);
+  ret_val = para::AllReduce(val_f.data(), res_f.data(), count, MPI_FLOAT, MPI_MAX, comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < count; ++i) {
+    assert(res_f[i] == size - 0.75f);
+  }
+}
+
+// node p receives (p % 3) * count elements, so some nodes get nothing
+void TestReduceScatter(para::ReduceScatterAlgorithm algorithm, int count,
+                       MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+
+  vector<int> recvcounts(size);
+  int total_count = 0, displ = 0;
+  for (int p = 0; p < size; ++p) {
+    recvcounts[p] = (p % 3) * count;
+    displ += p < rank ? recvcounts[p] : 0;
+    total_count += recvcounts[p];
+  }
+
+  vector<int> val(total_count);
+  vector<double> val_d(total_count);
+  for (int i = 0; i < total_count; ++i) {
+    val[i] = rank + i;
+    val_d[i] = rank * 0.5 - i;
+  }
+  vector<int> res(recvcounts[rank], -1);
+  vector<double> res_d(recvcounts[rank], -1.0);
+
+  auto ret_val = para::ReduceScatter(val.data(), res.data(), recvcounts.data(), MPI_INT, MPI_SUM,
+                                     comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < recvcounts[rank]; ++i) {
+    assert(res[i] == size * (size - 1) / 2 + size * (displ + i));
+  }
+  ret_val = para::ReduceScatter(val_d.data(), res_d.data(), recvcounts.data(), MPI_DOUBLE, MPI_MIN,
+                                comm, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int i = 0; i < recvcounts[rank]; ++i) {
+    assert(res_d[i] == -(displ + i));
+  }
+}
+
+void TestSubComm() {
+  int rank = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm half;
+  ::MPI_Comm_split(MPI_COMM_WORLD, rank % 2, rank, &half);
+  int size = 0;
+  ::MPI_Comm_size(half, &size);
+
+  para::AllGatherAlgorithm algorithms[] = {para::ALLGATHER_GATHER_BCAST, para::ALLGATHER_RING,
+                                           para::ALLGATHER_RECURSIVE_DOUBLING, para::ALLGATHER_BRUCK,
+                                           para::ALLGATHER_HIERARCHICAL, para::ALLGATHER_SHARED_MEMORY};
+  for (auto algorithm : algorithms) {
+    TestAllGather(algorithm, 3, half);
+  }
+  for (int root = 0; root < size; ++root) {
+    TestGather(root, half);
+    TestBcast(para::BCAST_LINEAR, 5, root, half);
+    TestBcast(para::BCAST_BINOMIAL, 5, root, half);
+    TestBcast(para::BCAST_HIERARCHICAL, 5, root, half);
+  }
+  TestAllReduce(para::ALLREDUCE_RING, 10, half);
+  TestAllReduce(para::ALLREDUCE_RECURSIVE_DOUBLING, 10, half);
+  TestReduceScatter(para::REDUCESCATTER_RING, 2, half);
+  TestReduceScatter(para::REDUCESCATTER_RECURSIVE_HALVING, 2, half);
+  ::MPI_Comm_free(&half);
+}
+
+// ranks are grouped into fake nodes of the given size, or round robin into
+// num_nodes nodes, so node ranks are not contiguous
+void TestHierarchical(int node_size, int num_nodes) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  ::MPI_Comm comm, node_comm;
+  ::MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+  int color = node_size > 0 ? rank / node_size : rank % num_nodes;
+  ::MPI_Comm_split(comm, color, rank, &node_comm);
+  auto ret_val = para::SetNodeComm(comm, node_comm);
+  assert(ret_val == MPI_SUCCESS);
+
+  TestAllGather(para::ALLGATHER_HIERARCHICAL, 1, comm);
+  TestAllGather(para::ALLGATHER_HIERARCHICAL, 20000, comm);
+  for (int root = 0; root < size; ++root) {
+    TestBcast(para::BCAST_HIERARCHICAL, 1000, root, comm);
+  }
+
+  ::MPI_Comm_free(&comm);
+  ::MPI_Comm_free(&node_comm);
+}
+
+void TestAllGatherShared() {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  para::SharedGatherBuffer buffer;
+  for (int round = 0; round < 3; ++round) {
+    // the window grows with the message
+    int count = 10 + round * 5000;
+    vector<int> val(count, rank + round);
+    const void* result = nullptr;
+    auto ret_val = para::AllGatherShared(val.data(), count, MPI_INT, count, MPI_INT, MPI_COMM_WORLD,
+                                         &buffer, &result);
+    assert(ret_val == MPI_SUCCESS);
+    const int* arr = static_cast<const int*>(result);
+    for (int i = 0; i < count * size; ++i) {
+      assert(arr[i] == i / count + round);
+    }
+  }
+  buffer.Free();
+}
+
+// node p contributes (p * 7) % 5 elements, blocks are stored in reverse
+// node order with a gap of one element between them
+void RaggedLayout(int size, int scale, vector<int>* counts, vector<int>* displs, int* total) {
+  counts->assign(size, 0);
+  displs->assign(size, 0);
+  *total = 0;
+  for (int p = size - 1; p >= 0; --p) {
+    (*counts)[p] = ((p * 7) % 5) * scale;
+    (*displs)[p] = *total;
+    *total += (*counts)[p] + 1;
+  }
+}
+
+void TestGatherv(int scale) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  vector<int> counts, displs;
+  int total = 0;
+  RaggedLayout(size, scale, &counts, &displs, &total);
+
+  vector<int> val(counts[rank]);
+  for (int i = 0; i < counts[rank]; ++i) {
+    val[i] = rank * 1000000 + i;
+  }
+
+  for (int root = 0; root < size; ++root) {
+    vector<int> arr(total, -1);
+    auto ret_val = para::Gatherv(val.data(), counts[rank], MPI_INT, arr.data(), counts.data(),
+                                 displs.data(), MPI_INT, root, MPI_COMM_WORLD);
+    assert(ret_val == MPI_SUCCESS);
+    if (rank == root) {
+      for (int p = 0; p < size; ++p) {
+        for (int i = 0; i < counts[p]; ++i) {
+          assert(arr[displs[p] + i] == p * 1000000 + i);
+        }
+        // gaps are untouched
+        assert(arr[displs[p] + counts[p]] == -1);
+      }
+    }
+  }
+}
+
+void TestAllGatherv(para::AllGatherAlgorithm algorithm, int scale) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  vector<int> counts, displs;
+  int total = 0;
+  RaggedLayout(size, scale, &counts, &displs, &total);
+
+  vector<double> val(counts[rank]);
+  for (int i = 0; i < counts[rank]; ++i) {
+    val[i] = rank + i * 0.5;
+  }
+  vector<double> arr(total, -1.0);
+  auto ret_val = para::AllGatherv(val.data(), counts[rank], MPI_DOUBLE, arr.data(), counts.data(),
+                                  displs.data(), MPI_DOUBLE, MPI_COMM_WORLD, algorithm);
+  assert(ret_val == MPI_SUCCESS);
+  for (int p = 0; p < size; ++p) {
+    for (int i = 0; i < counts[p]; ++i) {
+      assert(arr[displs[p] + i] == p + i * 0.5);
+    }
+    assert(arr[displs[p] + counts[p]] == -1.0);
+  }
+}
+
 int main(int argc, char *argv[])
 {
   ::MPI_Init(&argc, &argv);
-  int arr[10] = {0};
   int rank = 0;
   ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  int val[] = {(rank + 2) * (9 + rank), (rank - 2)};
-  
-  auto ret_val = para::AllGather(val, 2, MPI_INT, arr, 2, MPI_INT, MPI_COMM_WORLD);
-  printf("%d: ", rank);
-  for (int i = 0; i < 10; ++i){
-    printf("%d ", arr[i]);
+
+  if (!rank) {
+    printf("=================Test starts=================\n\n");
+  }
+
+  const char* names[] = {"auto", "gather + bcast", "ring", "recursive doubling", "bruck",
+                         "hierarchical", "shared memory"};
+  para::AllGatherAlgorithm algorithms[] = {para::ALLGATHER_AUTO, para::ALLGATHER_GATHER_BCAST,
+                                           para::ALLGATHER_RING, para::ALLGATHER_RECURSIVE_DOUBLING,
+                                           para::ALLGATHER_BRUCK, para::ALLGATHER_HIERARCHICAL,
+                                           para::ALLGATHER_SHARED_MEMORY};
+  for (int i = 0; i < 7; ++i) {
+    if (!rank) {
+      printf("Test AllGather (%s)...\n", names[i]);
+    }
+    TestAllGather(algorithms[i], 2);
+    TestAllGather(algorithms[i], 100000);
+    TestAllGatherTypes(algorithms[i]);
+    if (!rank) {
+      printf("test case pass...\n\n");
+    }
+  }
+
+  if (!rank) {
+    printf("Test AllGatherShared...\n");
+  }
+  TestAllGatherShared();
+  if (!rank) {
+    printf("test case pass...\n\n");
+  }
+
+  if (!rank) {
+    printf("Test Gatherv...\n");
+  }
+  TestGatherv(1);
+  TestGatherv(30000);
+  if (!rank) {
+    printf("test case pass...\n\n");
+  }
+
+  const char* v_names[] = {"auto", "tree", "ring"};
+  para::AllGatherAlgorithm v_algorithms[] = {para::ALLGATHER_AUTO, para::ALLGATHER_GATHER_BCAST,
+                                             para::ALLGATHER_RING};
+  for (int i = 0; i < 3; ++i) {
+    if (!rank) {
+      printf("Test AllGatherv (%s)...\n", v_names[i]);
+    }
+    TestAllGatherv(v_algorithms[i], 1);
+    TestAllGatherv(v_algorithms[i], 30000);
+    if (!rank) {
+      printf("test case pass...\n\n");
+    }
+  }
+
+  const char* allreduce_names[] = {"auto", "ring", "recursive doubling"};
+  para::AllReduceAlgorithm allreduce_algorithms[] = {para::ALLREDUCE_AUTO, para::ALLREDUCE_RING,
+                                                     para::ALLREDUCE_RECURSIVE_DOUBLING};
+  for (int i = 0; i < 3; ++i) {
+    if (!rank) {
+      printf("Test AllReduce (%s)...\n", allreduce_names[i]);
+    }
+    TestAllReduce(allreduce_algorithms[i], 1);
+    TestAllReduce(allreduce_algorithms[i], 7);
+    TestAllReduce(allreduce_algorithms[i], 100001);
+    if (!rank) {
+      printf("test case pass...\n\n");
+    }
+  }
+
+  const char* reduce_scatter_names[] = {"auto", "ring", "recursive halving"};
+  para::ReduceScatterAlgorithm reduce_scatter_algorithms[] = {
+    para::REDUCESCATTER_AUTO, para::REDUCESCATTER_RING, para::REDUCESCATTER_RECURSIVE_HALVING};
+  for (int i = 0; i < 3; ++i) {
+    if (!rank) {
+      printf("Test ReduceScatter (%s)...\n", reduce_scatter_names[i]);
+    }
+    TestReduceScatter(reduce_scatter_algorithms[i], 1);
+    TestReduceScatter(reduce_scatter_algorithms[i], 40000);
+    if (!rank) {
+      printf("test case pass...\n\n");
+    }
+  }
+
+  for (int i = 0; i < 7; ++i) {
+    if (!rank) {
+      printf("Test IAllGather (%s)...\n", names[i]);
+    }
+    TestIAllGather(algorithms[i], 3);
+    TestIAllGather(algorithms[i], 50000);
+    if (!rank) {
+      printf("test case pass...\n\n");
+    }
+  }
+
+  const char* bcast_names[] = {"auto", "linear", "binomial", "scatter + allgather", "pipeline",
+                               "hierarchical"};
+  para::BcastAlgorithm bcast_algorithms[] = {para::BCAST_AUTO, para::BCAST_LINEAR, para::BCAST_BINOMIAL,
+                                             para::BCAST_SCATTER_ALLGATHER, para::BCAST_PIPELINE,
+                                             para::BCAST_HIERARCHICAL};
+  int size = 0;
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+  para::SetBcastSegmentSize(4096);
+  for (int i = 0; i < 6; ++i) {
+    if (!rank) {
+      printf("Test Bcast and IBcast (%s)...\n", bcast_names[i]);
+    }
+    for (int root = 0; root < size; ++root) {
+      TestBcast(bcast_algorithms[i], 1, root);
+      TestBcast(bcast_algorithms[i], 7, root);
+      TestBcast(bcast_algorithms[i], 300001, root);
+      TestIBcast(bcast_algorithms[i], 1, root);
+      TestIBcast(bcast_algorithms[i], 7, root);
+      TestIBcast(bcast_algorithms[i], 100001, root);
+    }
+    if (!rank) {
+      printf("test case pass...\n\n");
+    }
+  }
+  para::SetBcastSegmentSize(para::BCAST_SEGMENT_SIZE);
+
+  if (!rank) {
+    printf("Test sub communicators...\n");
+  }
+  TestSubComm();
+  if (!rank) {
+    printf("test case pass...\n\n");
+    printf("Test two-level collectives...\n");
   }
-  printf("\n");
+  TestHierarchical(2, 0);
+  TestHierarchical(3, 0);
+  TestHierarchical(0, 2);
+  TestHierarchical(0, 3);
+  if (!rank) {
+    printf("test case pass...\n\n");
+  }
+
+  if (!rank) {
+    printf("=================Test ends=================\n");
+  }
+
+  ::MPI_Finalize();
   return 0;
 }
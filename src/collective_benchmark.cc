@@ -0,0 +1,361 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// Micro benchmark of the para collectives against the stock MPI ones.
+//
+// For every rank count (powers of two up to the world size, and the world
+// size itself) and every message size, each implementation is run `iters`
+// times after `warmup` untimed runs. One CSV row is written per run:
+//
+//   op,impl,ranks,bytes,iters,avg_us,min_us,max_us,algbw_GBps,busbw_GBps
+//
+// `bytes` is the size of the whole result: the gathered buffer for Gather and
+// AllGather, the broadcast buffer for Bcast, the reduced buffer of doubles for
+// AllReduce and ReduceScatter. The latencies are the per call time averaged
+// over iterations, then averaged / min / max over ranks. algbw is
+// bytes / avg_us, busbw scales it by the share of data that has to cross the
+// links, (n - 1) / n for the gathers and ReduceScatter, 2(n - 1) / n for
+// AllReduce and 1 for Bcast.
+//
+// usage: collective_benchmark [-b min_bytes] [-e max_bytes] [-f factor]
+//                             [-i iters] [-w warmup] [-r min_ranks]
+//                             [-x gather|bcast|allgather|allreduce|reducescatter] [-o out.csv]
+
+#include "all_gather.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+
+// messages of at least this size run iters / 10 times
+const size_t LARGE_MSG_SIZE = 1 << 20;
+
+struct BenchConfig {
+  size_t min_bytes = 1;
+  size_t max_bytes = 1 << 22;
+  size_t factor = 2;
+  int iters = 100;
+  int warmup = 10;
+  int min_ranks = 2;
+  std::string op;
+  std::string out_path;
+  FILE* out = stdout;
+};
+
+// Times `iters` calls of `run` on `comm`. Returns false if the collective
+// reports an error, e.g. an algorithm which doesn't support this comm.
+bool TimeCollective(const BenchConfig& config, const std::function<int()>& run, int iters,
+                    MPI_Comm comm, double* avg_us, double* min_us, double* max_us) {
+  int ok = 1;
+  for (int i = 0; i < config.warmup && ok; ++i) {
+    ok = run() == MPI_SUCCESS;
+  }
+  int all_ok = 0;
+  ::MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+  if (!all_ok) {
+    return false;
+  }
+
+  ::MPI_Barrier(comm);
+  double start = ::MPI_Wtime();
+  for (int i = 0; i < iters; ++i) {
+    run();
+  }
+  double local_us = (::MPI_Wtime() - start) * 1e6 / iters;
+
+  int size = 0;
+  ::MPI_Comm_size(comm, &size);
+  ::MPI_Allreduce(&local_us, avg_us, 1, MPI_DOUBLE, MPI_SUM, comm);
+  *avg_us /= size;
+  ::MPI_Allreduce(&local_us, min_us, 1, MPI_DOUBLE, MPI_MIN, comm);
+  ::MPI_Allreduce(&local_us, max_us, 1, MPI_DOUBLE, MPI_MAX, comm);
+  return true;
+}
+
+void Report(const BenchConfig& config, const char* op, const char* impl, int ranks, size_t bytes,
+            int iters, double avg_us, double min_us, double max_us, double bus_factor) {
+  double algbw = bytes / avg_us / 1e3;
+  ::fprintf(config.out, "%s,%s,%d,%zu,%d,%.2f,%.2f,%.2f,%.4f,%.4f\n", op, impl, ranks, bytes,
+            iters, avg_us, min_us, max_us, algbw, algbw * bus_factor);
+  ::fflush(config.out);
+}
+
+void BenchGather(const BenchConfig& config, MPI_Comm comm, size_t bytes) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+  int count = bytes / size;
+  if (count == 0) {
+    return;
+  }
+  bytes = size_t(count) * size;
+  int iters = bytes >= LARGE_MSG_SIZE ? std::max(1, config.iters / 10) : config.iters;
+
+  vector<char> sendbuf(count, rank);
+  vector<char> recvbuf(bytes);
+  const char* names[] = {"para", "mpi"};
+  std::function<int()> runs[] = {
+    [&]() {
+      return para::Gather(sendbuf.data(), count, MPI_CHAR, recvbuf.data(), count, MPI_CHAR,
+                          0, comm);
+    },
+    [&]() {
+      return ::MPI_Gather(sendbuf.data(), count, MPI_CHAR, recvbuf.data(), count, MPI_CHAR,
+                          0, comm);
+    }
+  };
+  for (int i = 0; i < 2; ++i) {
+    double avg_us, min_us, max_us;
+    if (TimeCollective(config, runs[i], iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+      Report(config, "gather", names[i], size, bytes, iters, avg_us, min_us, max_us,
+             (size - 1.0) / size);
+    }
+  }
+}
+
+void BenchBcast(const BenchConfig& config, MPI_Comm comm, size_t bytes) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+  int iters = bytes >= LARGE_MSG_SIZE ? std::max(1, config.iters / 10) : config.iters;
+
+  vector<char> buffer(bytes, rank);
+  const char* names[] = {"para_auto", "para_linear", "para_binomial", "para_scatter_allgather",
+                         "para_pipeline", "para_hierarchical"};
+  para::BcastAlgorithm algorithms[] = {para::BCAST_AUTO, para::BCAST_LINEAR,
+                                       para::BCAST_BINOMIAL, para::BCAST_SCATTER_ALLGATHER,
+                                       para::BCAST_PIPELINE, para::BCAST_HIERARCHICAL};
+  for (int i = 0; i < 6; ++i) {
+    auto run = [&]() {
+      return para::Bcast(buffer.data(), bytes, MPI_CHAR, 0, comm, algorithms[i]);
+    };
+    double avg_us, min_us, max_us;
+    if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+      Report(config, "bcast", names[i], size, bytes, iters, avg_us, min_us, max_us, 1.0);
+    }
+  }
+
+  auto run = [&]() {
+    return ::MPI_Bcast(buffer.data(), bytes, MPI_CHAR, 0, comm);
+  };
+  double avg_us, min_us, max_us;
+  if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+    Report(config, "bcast", "mpi", size, bytes, iters, avg_us, min_us, max_us, 1.0);
+  }
+}
+
+void BenchAllGather(const BenchConfig& config, MPI_Comm comm, size_t bytes) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+  int count = bytes / size;
+  if (count == 0) {
+    return;
+  }
+  bytes = size_t(count) * size;
+  int iters = bytes >= LARGE_MSG_SIZE ? std::max(1, config.iters / 10) : config.iters;
+
+  vector<char> sendbuf(count, rank);
+  vector<char> recvbuf(bytes);
+  const char* names[] = {"para_auto", "para_gather_bcast", "para_ring",
+                         "para_recursive_doubling", "para_bruck", "para_hierarchical",
+                         "para_shared_memory"};
+  para::AllGatherAlgorithm algorithms[] = {para::ALLGATHER_AUTO, para::ALLGATHER_GATHER_BCAST,
+                                           para::ALLGATHER_RING, para::ALLGATHER_RECURSIVE_DOUBLING,
+                                           para::ALLGATHER_BRUCK, para::ALLGATHER_HIERARCHICAL,
+                                           para::ALLGATHER_SHARED_MEMORY};
+  for (int i = 0; i < 7; ++i) {
+    auto run = [&]() {
+      return para::AllGather(sendbuf.data(), count, MPI_CHAR, recvbuf.data(), count, MPI_CHAR,
+                             comm, algorithms[i]);
+    };
+    double avg_us, min_us, max_us;
+    if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+      Report(config, "allgather", names[i], size, bytes, iters, avg_us, min_us, max_us,
+             (size - 1.0) / size);
+    }
+  }
+
+  auto run = [&]() {
+    return ::MPI_Allgather(sendbuf.data(), count, MPI_CHAR, recvbuf.data(), count, MPI_CHAR,
+                           comm);
+  };
+  double avg_us, min_us, max_us;
+  if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+    Report(config, "allgather", "mpi", size, bytes, iters, avg_us, min_us, max_us,
+           (size - 1.0) / size);
+  }
+}
+
+void BenchAllReduce(const BenchConfig& config, MPI_Comm comm, size_t bytes) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+  int count = bytes / sizeof(double);
+  if (count == 0) {
+    return;
+  }
+  bytes = count * sizeof(double);
+  int iters = bytes >= LARGE_MSG_SIZE ? std::max(1, config.iters / 10) : config.iters;
+
+  vector<double> sendbuf(count, rank);
+  vector<double> recvbuf(count);
+  const char* names[] = {"para_auto", "para_ring", "para_recursive_doubling"};
+  para::AllReduceAlgorithm algorithms[] = {para::ALLREDUCE_AUTO, para::ALLREDUCE_RING,
+                                           para::ALLREDUCE_RECURSIVE_DOUBLING};
+  for (int i = 0; i < 3; ++i) {
+    auto run = [&]() {
+      return para::AllReduce(sendbuf.data(), recvbuf.data(), count, MPI_DOUBLE, MPI_SUM, comm,
+                             algorithms[i]);
+    };
+    double avg_us, min_us, max_us;
+    if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+      Report(config, "allreduce", names[i], size, bytes, iters, avg_us, min_us, max_us,
+             2.0 * (size - 1) / size);
+    }
+  }
+
+  auto run = [&]() {
+    return ::MPI_Allreduce(sendbuf.data(), recvbuf.data(), count, MPI_DOUBLE, MPI_SUM, comm);
+  };
+  double avg_us, min_us, max_us;
+  if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+    Report(config, "allreduce", "mpi", size, bytes, iters, avg_us, min_us, max_us,
+           2.0 * (size - 1) / size);
+  }
+}
+
+// bytes is the size of the send buffer, which is scattered in equal blocks
+void BenchReduceScatter(const BenchConfig& config, MPI_Comm comm, size_t bytes) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+  int count = bytes / sizeof(double) / size;
+  if (count == 0) {
+    return;
+  }
+  bytes = size_t(count) * size * sizeof(double);
+  int iters = bytes >= LARGE_MSG_SIZE ? std::max(1, config.iters / 10) : config.iters;
+
+  vector<double> sendbuf(size_t(count) * size, rank);
+  vector<double> recvbuf(count);
+  vector<int> recvcounts(size, count);
+  const char* names[] = {"para_auto", "para_ring", "para_recursive_halving"};
+  para::ReduceScatterAlgorithm algorithms[] = {para::REDUCESCATTER_AUTO, para::REDUCESCATTER_RING,
+                                               para::REDUCESCATTER_RECURSIVE_HALVING};
+  for (int i = 0; i < 3; ++i) {
+    auto run = [&]() {
+      return para::ReduceScatter(sendbuf.data(), recvbuf.data(), recvcounts.data(), MPI_DOUBLE,
+                                 MPI_SUM, comm, algorithms[i]);
+    };
+    double avg_us, min_us, max_us;
+    if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+      Report(config, "reducescatter", names[i], size, bytes, iters, avg_us, min_us, max_us,
+             (size - 1.0) / size);
+    }
+  }
+
+  auto run = [&]() {
+    return ::MPI_Reduce_scatter(sendbuf.data(), recvbuf.data(), recvcounts.data(), MPI_DOUBLE,
+                                MPI_SUM, comm);
+  };
+  double avg_us, min_us, max_us;
+  if (TimeCollective(config, run, iters, comm, &avg_us, &min_us, &max_us) && !rank) {
+    Report(config, "reducescatter", "mpi", size, bytes, iters, avg_us, min_us, max_us,
+           (size - 1.0) / size);
+  }
+}
+
+bool ParseArgs(int argc, char *argv[], BenchConfig* config) {
+  int opt;
+  while ((opt = ::getopt(argc, argv, "b:e:f:i:w:r:x:o:")) != -1) {
+    switch (opt) {
+      case 'b': config->min_bytes = std::strtoull(optarg, nullptr, 10); break;
+      case 'e': config->max_bytes = std::strtoull(optarg, nullptr, 10); break;
+      case 'f': config->factor = std::strtoull(optarg, nullptr, 10); break;
+      case 'i': config->iters = std::atoi(optarg); break;
+      case 'w': config->warmup = std::atoi(optarg); break;
+      case 'r': config->min_ranks = std::atoi(optarg); break;
+      case 'x': config->op = optarg; break;
+      case 'o': config->out_path = optarg; break;
+      default: return false;
+    }
+  }
+  return config->min_bytes > 0 && config->min_bytes <= config->max_bytes &&
+         config->max_bytes <= INT32_MAX && config->factor > 1 && config->iters > 0 &&
+         config->warmup >= 0 && config->min_ranks > 0;
+}
+
+int main(int argc, char *argv[])
+{
+  ::MPI_Init(&argc, &argv);
+  int rank = 0, world_size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  BenchConfig config;
+  if (!ParseArgs(argc, argv, &config)) {
+    if (!rank) {
+      ::fprintf(stderr, "usage: %s [-b min_bytes] [-e max_bytes] [-f factor] [-i iters] "
+                "[-w warmup] [-r min_ranks] [-x gather|bcast|allgather|allreduce|reducescatter] [-o out.csv]\n", argv[0]);
+    }
+    ::MPI_Finalize();
+    return 1;
+  }
+  if (!rank) {
+    if (!config.out_path.empty()) {
+      config.out = ::fopen(config.out_path.c_str(), "w");
+      if (config.out == nullptr) {
+        ::fprintf(stderr, "cannot open %s\n", config.out_path.c_str());
+        ::MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+    }
+    ::fprintf(config.out, "op,impl,ranks,bytes,iters,avg_us,min_us,max_us,algbw_GBps,busbw_GBps\n");
+  }
+
+  vector<int> rank_counts;
+  for (int n = config.min_ranks; n < world_size; n *= 2) {
+    rank_counts.emplace_back(n);
+  }
+  rank_counts.emplace_back(world_size);
+
+  for (int n : rank_counts) {
+    MPI_Comm comm;
+    ::MPI_Comm_split(MPI_COMM_WORLD, rank < n ? 0 : MPI_UNDEFINED, rank, &comm);
+    if (comm != MPI_COMM_NULL) {
+      for (size_t bytes = config.min_bytes; bytes <= config.max_bytes; bytes *= config.factor) {
+        if (config.op.empty() || config.op == "gather") {
+          BenchGather(config, comm, bytes);
+        }
+        if (config.op.empty() || config.op == "bcast") {
+          BenchBcast(config, comm, bytes);
+        }
+        if (config.op.empty() || config.op == "allgather") {
+          BenchAllGather(config, comm, bytes);
+        }
+        if (config.op.empty() || config.op == "allreduce") {
+          BenchAllReduce(config, comm, bytes);
+        }
+        if (config.op.empty() || config.op == "reducescatter") {
+          BenchReduceScatter(config, comm, bytes);
+        }
+      }
+      ::MPI_Comm_free(&comm);
+    }
+    ::MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  if (!rank && config.out != stdout) {
+    ::fclose(config.out);
+  }
+  ::MPI_Finalize();
+  return 0;
+}
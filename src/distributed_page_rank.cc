@@ -0,0 +1,197 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+
+#include "distributed_page_rank.h"
+
+#include <algorithm>
+
+#include "all_gather.h"
+
+namespace para {
+
+void PageRankPartition(const uint64_t num_nodes, int rank, int size,
+                       uint64_t* first, uint64_t* last) {
+  uint64_t quotient = num_nodes / size;
+  uint64_t remainder = num_nodes % size;
+  // the first remainder ranks own one node more
+  uint64_t r = rank;
+  *first = r * quotient + (r < remainder ? r : remainder);
+  *last = *first + quotient + (r < remainder ? 1 : 0);
+}
+
+// \return rank owning node in the partition of PageRankPartition()
+static int PartitionOwner(const uint64_t num_nodes, int size, const uint64_t node) {
+  uint64_t quotient = num_nodes / size;
+  uint64_t remainder = num_nodes % size;
+  uint64_t large = remainder * (quotient + 1);
+  if (node < large) {
+    return node / (quotient + 1);
+  }
+  return remainder + (node - large) / quotient;
+}
+
+DistributedPageRanker::DistributedPageRanker(double damping_factor_, int max_iter_,
+                                             double precision_)
+    : damping_factor(damping_factor_), max_iter(max_iter_), precision(precision_) {}
+
+template <typename Offset, typename Index>
+int DistributedPageRanker::PageRank(const BasicCSRGraph<Offset, Index>& graph, MPI_Comm comm,
+                                    vector<double>* page_rank) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+
+  uint64_t num_nodes = graph.num_nodes();
+  uint64_t first = 0, last = 0;
+  PageRankPartition(num_nodes, rank, size, &first, &last);
+  int64_t num_local = last - first;
+  const Offset* csr_indptr = graph.indptr() + first;
+  const Index* csr_indices = graph.indices();
+  const Offset* out_degree = graph.out_degree() + first;
+  Offset base = csr_indptr[0];
+  int64_t num_local_nonzeros = csr_indptr[num_local] - base;
+
+  // nodes of other ranks linked from the rows of this rank, grouped by owner
+  vector<uint64_t> ghosts;
+  for (int64_t j = 0; j < num_local_nonzeros; ++j) {
+    uint64_t node = csr_indices[base + j];
+    if (node < first || node >= last) {
+      ghosts.emplace_back(node);
+    }
+  }
+  std::sort(ghosts.begin(), ghosts.end());
+  ghosts.erase(std::unique(ghosts.begin(), ghosts.end()), ghosts.end());
+
+  vector<int> recv_counts(size, 0), recv_displs(size, 0);
+  for (uint64_t node : ghosts) {
+    ++recv_counts[PartitionOwner(num_nodes, size, node)];
+  }
+  for (int p = 1; p < size; ++p) {
+    recv_displs[p] = recv_displs[p - 1] + recv_counts[p - 1];
+  }
+
+  // tell the owners which of their nodes this rank needs
+  vector<int> send_counts(size, 0), send_displs(size, 0);
+  int ret_val = ::MPI_Alltoall(recv_counts.data(), 1, MPI_INT, send_counts.data(), 1, MPI_INT,
+                               comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  for (int p = 1; p < size; ++p) {
+    send_displs[p] = send_displs[p - 1] + send_counts[p - 1];
+  }
+  vector<uint64_t> requested(send_displs[size - 1] + send_counts[size - 1]);
+  ret_val = ::MPI_Alltoallv(ghosts.data(), recv_counts.data(), recv_displs.data(), MPI_UINT64_T,
+                            requested.data(), send_counts.data(), send_displs.data(),
+                            MPI_UINT64_T, comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  vector<Index> send_nodes(requested.size());
+  for (size_t k = 0; k < requested.size(); ++k) {
+    send_nodes[k] = requested[k] - first;
+  }
+  vector<uint64_t>().swap(requested);
+
+  // Columns of the local rows in x: the nodes of this rank come first, then
+  // the ghosts in the order they are received.
+  vector<Index> local_indices(num_local_nonzeros);
+  #pragma omp parallel for
+  for (int64_t j = 0; j < num_local_nonzeros; ++j) {
+    uint64_t node = csr_indices[base + j];
+    if (node >= first && node < last) {
+      local_indices[j] = node - first;
+    } else {
+      local_indices[j] = num_local + (std::lower_bound(ghosts.begin(), ghosts.end(), node) -
+                                      ghosts.begin());
+    }
+  }
+  size_t num_ghosts = ghosts.size();
+  vector<uint64_t>().swap(ghosts);
+
+  // weight of the links of every node
+  vector<double> inv_out(num_local);
+  vector<double> u(num_local, 1.0 / num_nodes);
+  // u scaled by the inverse out degrees, followed by the ghosts, and the one
+  // of the next iteration
+  vector<double> x(num_local + num_ghosts), next_x(num_local + num_ghosts);
+  // the rank of the local nodes that have no out links
+  double local_sum = 0.0;
+  #pragma omp parallel for reduction(+:local_sum)
+  for (int64_t i = 0; i < num_local; ++i) {
+    inv_out[i] = out_degree[i] > 0 ? 1.0 / out_degree[i] : 0.0;
+    x[i] = inv_out[i] * u[i];
+    local_sum += out_degree[i] == 0 ? u[i] : 0.0;
+  }
+  vector<double> send_buffer(send_nodes.size());
+  vector<MPI_Request> requests;
+  requests.reserve(2 * size);
+
+  double max_change = 1.0;
+  for (int iter = 0; iter < max_iter && max_change > precision; ++iter) {
+    #pragma omp parallel for
+    for (size_t k = 0; k < send_nodes.size(); ++k) {
+      send_buffer[k] = x[send_nodes[k]];
+    }
+
+    // exchange the ghosts with the ranks sharing edges with this rank only
+    requests.clear();
+    for (int p = 0; p < size; ++p) {
+      if (recv_counts[p] > 0) {
+        requests.emplace_back();
+        ::MPI_Irecv(x.data() + num_local + recv_displs[p], recv_counts[p], MPI_DOUBLE, p,
+                    PAGE_RANK_GHOST_TAG, comm, &requests.back());
+      }
+    }
+    for (int p = 0; p < size; ++p) {
+      if (send_counts[p] > 0) {
+        requests.emplace_back();
+        ::MPI_Isend(send_buffer.data() + send_displs[p], send_counts[p], MPI_DOUBLE, p,
+                    PAGE_RANK_GHOST_TAG, comm, &requests.back());
+      }
+    }
+    double sum_pr_without_outlinks = 0.0;
+    ret_val = AllReduce(&local_sum, &sum_pr_without_outlinks, 1, MPI_DOUBLE, MPI_SUM, comm);
+    int wait_ret_val = ::MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    if (ret_val != MPI_SUCCESS || wait_ret_val != MPI_SUCCESS) {
+      return ret_val != MPI_SUCCESS ? ret_val : wait_ret_val;
+    }
+
+    // one pass does the multiplication, the change and the scaling and
+    // dangling rank of the next iteration, as PageRanker::PowerMethodPR()
+    double local_max_change = 0.0;
+    local_sum = 0.0;
+    #pragma omp parallel for reduction(max:local_max_change) reduction(+:local_sum)
+    for (int64_t i = 0; i < num_local; ++i) {
+      double sum_j = 0.0;
+      for (Offset j = csr_indptr[i] - base; j < csr_indptr[i+1] - base; ++j) {
+        sum_j += x[local_indices[j]];
+      }
+      sum_j += sum_pr_without_outlinks / num_nodes;
+      double v = sum_j * damping_factor + (1.0 - damping_factor) / num_nodes;
+
+      double change = u[i] - v > 0.0 ? u[i] - v : v - u[i];
+      local_max_change = local_max_change > change ? local_max_change : change;
+      u[i] = v;
+      next_x[i] = inv_out[i] * v;
+      local_sum += inv_out[i] == 0.0 ? v : 0.0;
+    }
+    ret_val = AllReduce(&local_max_change, &max_change, 1, MPI_DOUBLE, MPI_MAX, comm);
+    if (ret_val != MPI_SUCCESS) {
+      return ret_val;
+    }
+
+    x.swap(next_x);
+  }
+
+  page_rank->swap(u);
+  return MPI_SUCCESS;
+}
+
+template int DistributedPageRanker::PageRank(const CSRGraph&, MPI_Comm, vector<double>*);
+template int DistributedPageRanker::PageRank(const LargeCSRGraph&, MPI_Comm, vector<double>*);
+template int DistributedPageRanker::PageRank(const HugeCSRGraph&, MPI_Comm, vector<double>*);
+
+} // namespace para
@@ -0,0 +1,63 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// Calculate PageRank of a graph over all ranks of a communicator.
+
+#ifndef DISTRIBUTED_PAGE_RANK_H_
+#define DISTRIBUTED_PAGE_RANK_H_
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#include <mpi.h>
+
+#include "page_rank.h"
+
+using std::vector;
+
+namespace para {
+
+const int PAGE_RANK_GHOST_TAG = 10201;
+
+// \brief Nodes [*first, *last) owned by rank out of size ranks. The nodes are
+// cut into contiguous ranges whose sizes differ by one at most.
+void PageRankPartition(const uint64_t num_nodes, int rank, int size,
+                       uint64_t* first, uint64_t* last);
+
+class DistributedPageRanker {
+ public:
+  DistributedPageRanker(double damping_factor_, int max_iter_, double precision_);
+  ~DistributedPageRanker() = default;
+
+  // \brief Calculate PageRank value of a graph with all ranks of comm.
+  //
+  // Every rank owns the rows of the nodes PageRankPartition() gives it and
+  // computes their PageRank values with OpenMP. It reads nothing of graph but
+  // its own rows and out degrees, so graph is best a CSR file mapped with
+  // Load() on a shared file system: every rank then touches only its slice.
+  //
+  // Before the first iteration the ranks tell each other which of their
+  // nodes are linked from other ranks. Every iteration then sends only those
+  // "ghost" values, already scaled by the inverse out degree, point to point,
+  // and reduces the rank of the dangling nodes and the largest change with
+  // AllReduce(). Collective over comm.
+  //
+  // \param graph CSR matrix of the graph, the same on every rank
+  // \param page_rank PageRank values of the nodes this rank owns. It's the returning value
+  // \return MPI_SUCCESS on success
+  template <typename Offset, typename Index>
+  int PageRank(const BasicCSRGraph<Offset, Index>& graph, MPI_Comm comm,
+               vector<double>* page_rank);
+
+ private:
+  double damping_factor = 0.85;
+  int max_iter = 29;
+  double precision = 0.000000001;
+};
+
+} // namespace para
+
+
+#endif
@@ -0,0 +1,107 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// test distributed PageRank
+
+
+#include "distributed_page_rank.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+// \brief Rank the graph with all ranks and compare the gathered result at rank
+// 0 with the OpenMP PageRanker.
+template <typename Graph>
+void TestDistributedPageRank(const Graph& graph, const vector<double>& expected) {
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  para::DistributedPageRanker page_ranker(0.85, 100, 1e-12);
+  vector<double> local_rank;
+  auto ret_val = page_ranker.PageRank(graph, MPI_COMM_WORLD, &local_rank);
+  assert(ret_val == MPI_SUCCESS);
+
+  uint64_t first = 0, last = 0;
+  para::PageRankPartition(graph.num_nodes(), rank, size, &first, &last);
+  assert(local_rank.size() == last - first);
+
+  vector<int> counts(size), displs(size);
+  for (int p = 0; p < size; ++p) {
+    uint64_t p_first = 0, p_last = 0;
+    para::PageRankPartition(graph.num_nodes(), p, size, &p_first, &p_last);
+    counts[p] = p_last - p_first;
+    displs[p] = p_first;
+  }
+  vector<double> page_rank(graph.num_nodes());
+  ::MPI_Gatherv(local_rank.data(), local_rank.size(), MPI_DOUBLE, page_rank.data(),
+                counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    assert(page_rank.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      assert(std::fabs(page_rank[i] - expected[i]) < 1e-12);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  ::MPI_Init(&argc, &argv);
+  int rank = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // the same random graph with hubs and nodes without out links on every rank
+  std::mt19937 generator(7);
+  vector<vector<int>> connections;
+  for (int e = 0; e < 20000; ++e) {
+    int from = generator() % 1900;
+    int to = e % 5 ? generator() % 2000 : generator() % 10;
+    connections.push_back({from, to});
+  }
+  para::PageRanker page_ranker(0.85, 100, 1e-12);
+  vector<double> expected;
+  page_ranker.PageRank(connections, &expected);
+
+  if (!rank) {
+    printf("=================Test starts=================\n\n");
+    printf("Test DistributedPageRanker::PageRank...\n");
+  }
+  para::CSRGraph graph;
+  page_ranker.BuildGraph(connections, &graph);
+  TestDistributedPageRank(graph, expected);
+  para::HugeCSRGraph huge;
+  page_ranker.BuildGraph(connections, &huge);
+  TestDistributedPageRank(huge, expected);
+
+  // fewer nodes than ranks
+  vector<vector<int>> small_connections {{0, 1}, {2, 1}};
+  vector<double> small_expected;
+  page_ranker.PageRank(small_connections, &small_expected);
+  para::CSRGraph small;
+  page_ranker.BuildGraph(small_connections, &small);
+  TestDistributedPageRank(small, small_expected);
+  if (!rank) {
+    printf("test case pass...\n\n");
+    printf("Test DistributedPageRanker::PageRank on a mapped CSR file...\n");
+  }
+
+  const char* csr_path = "/tmp/distributed_page_rank_test.csr";
+  if (rank == 0) {
+    assert(graph.Save(csr_path));
+  }
+  ::MPI_Barrier(MPI_COMM_WORLD);
+  para::CSRGraph mapped;
+  assert(mapped.Load(csr_path));
+  TestDistributedPageRank(mapped, expected);
+  ::MPI_Barrier(MPI_COMM_WORLD);
+  if (!rank) {
+    ::remove(csr_path);
+    printf("test case pass...\n\n");
+    printf("=================Test ends=================\n");
+  }
+
+  ::MPI_Finalize();
+  return 0;
+}
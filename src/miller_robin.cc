@@ -7,107 +7,222 @@
 
 namespace para {
 
-bool MillerRobin(const int64_t candidate, const int num_tests) {
-  if (candidate == 2) {
-    return true;
+Montgomery::Montgomery(const uint64_t m_) : m(m_) {
+  // Newton's iteration, every step doubles the number of correct low bits,
+  // and m * m = 1 mod 8 for odd m
+  m_inv = m;
+  for (int i = 0; i < 5; ++i) {
+    m_inv *= 2 - m * m_inv;
   }
+  r1 = (0 - m) % m;
+  r2 = static_cast<uint64_t>(static_cast<unsigned __int128>(r1) * r1 % m);
+}
+
+// bases which make the strong probable prime test deterministic below 2^64
+static const uint64_t DETERMINISTIC_BASES[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+static const int NUM_DETERMINISTIC_BASES = 7;
 
-  // even number or less than 2
-  if (!(candidate & 1) || candidate < 2) {
-    return false;
+static const uint64_t SMALL_PRIMES[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47,
+                                        53, 59, 61, 67, 71, 73, 79, 83, 89, 97};
+static const int NUM_SMALL_PRIMES = 25;
+
+int TrialDivision(const uint64_t candidate) {
+  if (candidate < 2) {
+    return 0;
+  }
+  for (int i = 0; i < NUM_SMALL_PRIMES; ++i) {
+    if (candidate % SMALL_PRIMES[i] == 0) {
+      return candidate == SMALL_PRIMES[i];
+    }
   }
+  return candidate < 101 * 101 ? 1 : -1;
+}
 
-  int64_t t = 0, u = candidate - 1;
+// \brief Strong probable prime test of an odd candidate > 3 to the witnesses,
+// where candidate - 1 = u * 2^t with u odd. Groups of MILLER_ROBIN_LANES
+// witnesses run through the same exponent bits and squarings together.
+// Witnesses which are multiples of the candidate prove nothing and pass.
+//
+// \return true if the candidate passes the test for all witnesses
+static bool StrongProbablePrime(const Montgomery& mont, const uint64_t u, const int t,
+                                const uint64_t* witnesses, const int num_witnesses) {
+  const uint64_t one = mont.one();
+  const uint64_t minus_one = mont.modulus() - one;
+
+  for (int first = 0; first < num_witnesses; first += MILLER_ROBIN_LANES) {
+    uint64_t x[MILLER_ROBIN_LANES], b[MILLER_ROBIN_LANES];
+    bool pass[MILLER_ROBIN_LANES], multiple[MILLER_ROBIN_LANES];
+    for (int l = 0; l < MILLER_ROBIN_LANES; ++l) {
+      // missing lanes repeat the first witness of the group
+      int w = first + l < num_witnesses ? first + l : first;
+      x[l] = mont.To(witnesses[w]);
+      b[l] = one;
+      multiple[l] = x[l] == 0;
+    }
 
-  while(!(u & 1)) {
+    for (uint64_t n = u; n > 0; n >>= 1) {
+      if (n & 1) {
+        for (int l = 0; l < MILLER_ROBIN_LANES; ++l) {
+          b[l] = mont.Multiply(b[l], x[l]);
+        }
+      }
+      for (int l = 0; l < MILLER_ROBIN_LANES; ++l) {
+        x[l] = mont.Multiply(x[l], x[l]);
+      }
+    }
+
+    for (int l = 0; l < MILLER_ROBIN_LANES; ++l) {
+      pass[l] = multiple[l] || b[l] == one || b[l] == minus_one;
+    }
+    for (int i = 1; i < t; ++i) {
+      for (int l = 0; l < MILLER_ROBIN_LANES; ++l) {
+        b[l] = mont.Multiply(b[l], b[l]);
+        pass[l] = pass[l] || b[l] == minus_one;
+      }
+    }
+
+    for (int l = 0; l < MILLER_ROBIN_LANES; ++l) {
+      if (!pass[l]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// \brief Strong probable prime test of an odd candidate > 3 to all witnesses.
+static bool PassWitnesses(const uint64_t candidate, const uint64_t* witnesses,
+                          const int num_witnesses) {
+  uint64_t u = candidate - 1;
+  int t = 0;
+  while (!(u & 1)) {
     t += 1;
     u >>= 1;
   }
+  return StrongProbablePrime(Montgomery(candidate), u, t, witnesses, num_witnesses);
+}
+
+// \return a generator for this thread, seeded once from std::random_device
+static std::mt19937_64& ThreadGenerator() {
+  static thread_local std::mt19937_64 generator(std::random_device{}());
+  return generator;
+}
+
+bool MillerRobin(const uint64_t candidate, const int num_tests) {
+  int small = TrialDivision(candidate);
+  if (small >= 0) {
+    return small;
+  }
+
+  vector<uint64_t> witnesses(num_tests);
+  for (auto& w : witnesses) {
+    w = ThreadGenerator()() % (candidate - 3) + 2;
+  }
+
+  uint64_t u = candidate - 1;
+  int t = 0;
+  while (!(u & 1)) {
+    t += 1;
+    u >>= 1;
+  }
+  Montgomery mont(candidate);
 
   std::atomic_bool is_prime {true};
 
   #pragma omp parallel for
-  for (int _ = 0; _ < num_tests; ++_) {
+  for (int first = 0; first < num_tests; first += MILLER_ROBIN_LANES) {
     // the candidate has been detected as not a prime
     if (!is_prime) {
       continue;
     }
+    int count = num_tests - first < MILLER_ROBIN_LANES ? num_tests - first : MILLER_ROBIN_LANES;
+    if (!StrongProbablePrime(mont, u, t, witnesses.data() + first, count)) {
+      is_prime = false;
+    }
+  }
 
-    std::mt19937_64 generator(std::chrono::system_clock::now().time_since_epoch().count());
-    int64_t rand_num = generator() % (candidate - 2) + 2;
-
-    int64_t b = FastExponential(rand_num, u, candidate);
+  return is_prime;
+}
 
-    if (b == 1) {
-      continue;
-    }
+bool MillerRobinDeterministic(const uint64_t candidate) {
+  int small = TrialDivision(candidate);
+  if (small >= 0) {
+    return small;
+  }
+  return PassWitnesses(candidate, DETERMINISTIC_BASES, NUM_DETERMINISTIC_BASES);
+}
 
-    bool pass = false;
-    for (int i = 0; i <= t; ++i) {
-      if (b == candidate - 1) {
-        pass = true;
-        break;
-      }
-      if (b < (1 << 31)) {
-        b = (b * b) % candidate;
-      } else {
-        b = FastMultiply(b, b, candidate);
+void MillerRobinBatch(const uint64_t* candidates, size_t num_candidates, const int num_tests,
+                      vector<uint64_t>* is_prime) {
+  int64_t num_words = (num_candidates + 63) / 64;
+  is_prime->assign(num_words, 0);
+
+  #pragma omp parallel
+  {
+    std::mt19937_64& generator = ThreadGenerator();
+    vector<uint64_t> witnesses(num_tests);
+
+    #pragma omp for schedule(dynamic)
+    for (int64_t word = 0; word < num_words; ++word) {
+      uint64_t bits = 0;
+      size_t end = word * 64 + 64 < num_candidates ? word * 64 + 64 : num_candidates;
+      for (size_t i = word * 64; i < end; ++i) {
+        uint64_t candidate = candidates[i];
+        int prime = TrialDivision(candidate);
+        if (prime < 0) {
+          for (auto& w : witnesses) {
+            w = generator() % (candidate - 3) + 2;
+          }
+          prime = PassWitnesses(candidate, witnesses.data(), num_tests);
+        }
+        bits |= uint64_t(prime) << (i % 64);
       }
+      (*is_prime)[word] = bits;
     }
-    if (!pass) {
-      is_prime = false;
+  }
+}
+
+void MillerRobinDeterministicBatch(const uint64_t* candidates, size_t num_candidates,
+                                   vector<uint64_t>* is_prime) {
+  int64_t num_words = (num_candidates + 63) / 64;
+  is_prime->assign(num_words, 0);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int64_t word = 0; word < num_words; ++word) {
+    uint64_t bits = 0;
+    size_t end = word * 64 + 64 < num_candidates ? word * 64 + 64 : num_candidates;
+    for (size_t i = word * 64; i < end; ++i) {
+      bits |= uint64_t(MillerRobinDeterministic(candidates[i])) << (i % 64);
     }
+    (*is_prime)[word] = bits;
   }
-  
-  return is_prime;
 }
 
-int64_t FastExponential(const int64_t x, const int64_t n, const int64_t m) {
-  int64_t x_ = x % m;
-  int64_t n_ = n % m;
-  int64_t ans_ = 1;
-  
+uint64_t FastExponential(const uint64_t x, const uint64_t n, const uint64_t m) {
+  if (m & 1) {
+    Montgomery mont(m);
+    return mont.From(mont.Exponential(mont.To(x), n));
+  }
+
+  uint64_t x_ = x % m;
+  uint64_t n_ = n;
+  uint64_t ans_ = 1 % m;
   while (n_ > 0) {
     if (n_ & 1) {
-      if (ans_ < (1 << 31) && x_ < (1 << 31)) {
-        ans_ *= x_;
-        ans_ %= m;
-      } else {
-        ans_ = FastMultiply(ans_, x_, m);
-      } 
-    }
-    if (x_ < (1 << 31)) {
-      x_ *= x_;
-      x_ %= m;
-    } else {
-      x_ = FastMultiply(x_, x_, m);
+      ans_ = FastMultiply(ans_, x_, m);
     }
+    x_ = FastMultiply(x_, x_, m);
     n_ >>= 1;
   }
-
   return ans_;
 }
 
 
-int64_t FastMultiply(const int64_t x, const int64_t y, const int64_t m) {
-  int64_t x_ = x % m;
-  int64_t y_ = y % m;
-  int64_t ans_ = 0;
-
-  while (y_ > 0) {
-    if (y_ & 1) {
-      ans_ += x_;
-      ans_ %= m;
-    }
-    x_ <<= 1;
-    x_ %= m;
-    y_ >>= 1;
-  }
-  return ans_;
+uint64_t FastMultiply(const uint64_t x, const uint64_t y, const uint64_t m) {
+  return static_cast<uint64_t>(static_cast<unsigned __int128>(x) * y % m);
 }
 
 
 
 } // namespace para
 
-
@@ -12,37 +12,133 @@
 #include <random>
 #include <atomic>
 #include <chrono>
+#include <vector>
 #include <omp.h>
 
+using std::vector;
+
 namespace para {
 
+// Number of witnesses of one candidate which are exponentiated in lockstep.
+const int MILLER_ROBIN_LANES = 4;
+
+// \brief Modular arithmetic in Montgomery form for one odd modulus m.
+//
+// A number x is kept as x * 2^64 mod m, so a product costs two 64x64->128
+// multiplications and no division. Any odd modulus < 2^64 is supported.
+class Montgomery {
+ public:
+  explicit Montgomery(const uint64_t m_);
+
+  uint64_t modulus() const { return m; }
+
+  // \return 1 in Montgomery form
+  uint64_t one() const { return r1; }
+
+  // \return x in Montgomery form, any x < 2^64
+  uint64_t To(const uint64_t x) const { return Multiply(x % m, r2); }
+
+  // \return the ordinary value of x in Montgomery form
+  uint64_t From(const uint64_t x) const { return Reduce(x); }
+
+  // \return x * y in Montgomery form, for x, y < m in Montgomery form
+  uint64_t Multiply(const uint64_t x, const uint64_t y) const {
+    return Reduce(static_cast<unsigned __int128>(x) * y);
+  }
+
+  // \return x ^ n in Montgomery form, for x < m in Montgomery form
+  uint64_t Exponential(uint64_t x, uint64_t n) const {
+    uint64_t ans = r1;
+    while (n > 0) {
+      if (n & 1) {
+        ans = Multiply(ans, x);
+      }
+      x = Multiply(x, x);
+      n >>= 1;
+    }
+    return ans;
+  }
+
+ private:
+  // \return t / 2^64 mod m, for t < m * 2^64
+  uint64_t Reduce(const unsigned __int128 t) const {
+    uint64_t q = static_cast<uint64_t>(t) * m_inv;
+    uint64_t qm_high = static_cast<uint64_t>((static_cast<unsigned __int128>(q) * m) >> 64);
+    uint64_t t_high = static_cast<uint64_t>(t >> 64);
+    return t_high >= qm_high ? t_high - qm_high : t_high - qm_high + m;
+  }
+
+  // modulus, m^-1 mod 2^64, 2^64 mod m and 2^128 mod m
+  uint64_t m;
+  uint64_t m_inv;
+  uint64_t r1;
+  uint64_t r2;
+};
+
+// \brief Trial division by the primes below 100, the first step of every
+// Miller-Robin test here.
+//
+// \return 1 if the candidate is a prime, 0 if it is not, -1 if it has no
+// small factor but is too big to tell
+int TrialDivision(const uint64_t candidate);
+
 // \brief Test whether a number is a prime or not. Miller-Robin primality test.
-// OpenMP is used to speedup.
-// warning: assure that x,y,m < (2 ^ 62). Bigger values may overflow.
+// Small candidates and candidates with a factor below 100 are settled by trial
+// division. The witnesses are drawn from a generator seeded once per thread,
+// and OpenMP is used to speedup.
 //
-// \param candidate the number to be tested
+// \param candidate the number to be tested, any value < 2^64
 // \param num_tests number of tests
 // \return return true if the candidate is a prime, false if it is not a prime
-bool MillerRobin(const int64_t candidate, const int num_tests);
+bool MillerRobin(const uint64_t candidate, const int num_tests);
 
+// \brief Deterministic Miller-Robin primality test. Trial division by the
+// primes below 100, then the strong probable prime test to the bases
+// 2, 325, 9375, 28178, 450775, 9780504 and 1795265022, which has no
+// pseudoprime below 2^64.
+//
+// \param candidate the number to be tested, any value < 2^64
+// \return return true if the candidate is a prime, false if it is not a prime
+bool MillerRobinDeterministic(const uint64_t candidate);
 
-// \brief Calculate exponential: x to the power of n, mod m.  
+// \brief Test a batch of candidates with Miller-Robin primality test.
 //
-// warning: assure that x,y,m < (2 ^ 62). Bigger values may overflow.
+// OpenMP threads take the candidates 64 at a time, one word of the bitmap
+// each, so the threads are forked once per batch. The witnesses of one
+// candidate share the modulus and the exponent, so they are exponentiated
+// MILLER_ROBIN_LANES at a time in lockstep, in Montgomery form.
+//
+// \param candidates the numbers to be tested
+// \param num_candidates number of candidates
+// \param num_tests number of tests per candidate
+// \param is_prime bitmap of the results, bit (i % 64) of word (i / 64) is set
+// if candidates[i] is a prime. It's the returning value
+void MillerRobinBatch(const uint64_t* candidates, size_t num_candidates, const int num_tests,
+                      vector<uint64_t>* is_prime);
+
+// \brief Test a batch of candidates with MillerRobinDeterministic(), spread
+// over OpenMP threads like MillerRobinBatch(). The bitmap is the same on
+// every run.
+void MillerRobinDeterministicBatch(const uint64_t* candidates, size_t num_candidates,
+                                   vector<uint64_t>* is_prime);
+
+
+// \brief Calculate exponential: x to the power of n, mod m.
+//
+// Odd moduli use Montgomery multiplication, even ones 128-bit products.
 //
 // \param x base
 // \param n exponential factor
-// \param m modulo
+// \param m modulo, m > 0
 // \return result of (x ^ n) % m
-int64_t FastExponential(const int64_t x, const int64_t n, const int64_t m);
+uint64_t FastExponential(const uint64_t x, const uint64_t n, const uint64_t m);
 
 
-// \brief Calculate multiplication: x times y, mod m.  
-//
-// warning: assure that x,y,m < (2 ^ 62). Bigger values may overflow.
+// \brief Calculate multiplication: x times y, mod m, with a 128-bit product.
 //
+// \param m modulo, m > 0
 // \return result of (x * y) % m
-int64_t FastMultiply(const int64_t x, const int64_t y, const int64_t m);
+uint64_t FastMultiply(const uint64_t x, const uint64_t y, const uint64_t m);
 
 } // namespace para
 
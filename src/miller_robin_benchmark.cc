@@ -0,0 +1,194 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// Throughput benchmark of the Miller-Robin test.
+//
+// For every bit width, random odd candidates with the top bit set are tested
+// with 1, 2, 4 ... max_tests random witnesses, and with the deterministic
+// bases (witnesses = 0 in the output). The three phases of the test are
+// timed on one thread over the whole candidate set:
+//
+//   trial division: TrialDivision() of every candidate
+//   exponentiation: a^u mod n in Montgomery form for the survivors
+//   squaring loop:  the t-1 squarings after it
+//
+// Then MillerRobinBatch / MillerRobinDeterministicBatch are timed end to end
+// on 1, 2, 4 ... max_threads threads. One CSV row is written per thread count:
+//
+//   bits,witnesses,threads,cand_per_s,ns_per_exp,trial_ns,exp_ns,square_ns,speedup
+//
+// cand_per_s is the end to end batch throughput, ns_per_exp the single thread
+// time of one exponentiation, trial_ns, exp_ns and square_ns the single
+// thread phase times per candidate, and speedup the batch speedup over one
+// thread. If the phase times add up to about the one thread batch time, the
+// modular arithmetic is the limit; a speedup well below threads points at
+// thread overhead.
+//
+// usage: miller_robin_benchmark [-n num_candidates] [-t max_threads] [-k max_tests]
+
+#include "miller_robin.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+struct PhaseTimes {
+  double trial_ns = 0.0;
+  double exp_ns = 0.0;
+  double square_ns = 0.0;
+  size_t num_exps = 0;
+};
+
+static double Now() {
+  return std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// \return num_candidates random odd numbers of exactly bits bits
+vector<uint64_t> RandomCandidates(int bits, size_t num_candidates) {
+  std::mt19937_64 generator(bits);
+  uint64_t top = uint64_t(1) << (bits - 1);
+  vector<uint64_t> candidates(num_candidates);
+  for (auto& c : candidates) {
+    c = (generator() & (top - 1 + top)) | top | 1;
+  }
+  return candidates;
+}
+
+// \brief Time the phases of the test on one thread. Every survivor of trial
+// division gets the witnesses, drawn in [2, n-2] from generator when bases is
+// nullptr.
+PhaseTimes TimePhases(const vector<uint64_t>& candidates, const uint64_t* bases,
+                      int num_witnesses) {
+  PhaseTimes times;
+
+  double start = Now();
+  vector<uint64_t> survivors;
+  for (auto c : candidates) {
+    if (para::TrialDivision(c) < 0) {
+      survivors.emplace_back(c);
+    }
+  }
+  times.trial_ns = Now() - start;
+
+  std::mt19937_64 generator(num_witnesses);
+  vector<uint64_t> witnesses(survivors.size() * num_witnesses);
+  for (size_t i = 0; i < survivors.size(); ++i) {
+    for (int w = 0; w < num_witnesses; ++w) {
+      witnesses[i * num_witnesses + w] = bases ? bases[w] : generator() % (survivors[i] - 3) + 2;
+    }
+  }
+
+  // a^u for every survivor and witness, kept in Montgomery form
+  vector<uint64_t> powers(witnesses.size());
+  start = Now();
+  for (size_t i = 0; i < survivors.size(); ++i) {
+    para::Montgomery mont(survivors[i]);
+    uint64_t u = survivors[i] - 1;
+    while (!(u & 1)) {
+      u >>= 1;
+    }
+    for (int w = 0; w < num_witnesses; ++w) {
+      powers[i * num_witnesses + w] = mont.Exponential(mont.To(witnesses[i * num_witnesses + w]), u);
+    }
+  }
+  times.exp_ns = Now() - start;
+  times.num_exps = powers.size();
+
+  uint64_t passed = 0;
+  start = Now();
+  for (size_t i = 0; i < survivors.size(); ++i) {
+    para::Montgomery mont(survivors[i]);
+    uint64_t minus_one = survivors[i] - mont.one();
+    int t = 0;
+    for (uint64_t u = survivors[i] - 1; !(u & 1); u >>= 1) {
+      ++t;
+    }
+    for (int w = 0; w < num_witnesses; ++w) {
+      uint64_t b = powers[i * num_witnesses + w];
+      bool pass = b == mont.one() || b == minus_one;
+      for (int s = 1; s < t; ++s) {
+        b = mont.Multiply(b, b);
+        pass = pass || b == minus_one;
+      }
+      passed += pass;
+    }
+  }
+  times.square_ns = Now() - start;
+
+  // keeps the loops from being optimized away
+  if (passed == uint64_t(-1)) {
+    ::printf("\n");
+  }
+  return times;
+}
+
+// \return seconds of one batch test of all candidates, witnesses = 0 for the
+// deterministic one
+double TimeBatch(const vector<uint64_t>& candidates, int witnesses) {
+  vector<uint64_t> is_prime;
+  double start = Now();
+  if (witnesses > 0) {
+    para::MillerRobinBatch(candidates.data(), candidates.size(), witnesses, &is_prime);
+  } else {
+    para::MillerRobinDeterministicBatch(candidates.data(), candidates.size(), &is_prime);
+  }
+  return (Now() - start) * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_candidates = 1 << 16;
+  int max_threads = omp_get_max_threads();
+  int max_tests = 16;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "n:t:k:")) != -1) {
+    switch (opt) {
+      case 'n': num_candidates = std::strtoull(optarg, nullptr, 10); break;
+      case 't': max_threads = std::atoi(optarg); break;
+      case 'k': max_tests = std::atoi(optarg); break;
+      default:
+        ::fprintf(stderr, "usage: %s [-n num_candidates] [-t max_threads] [-k max_tests]\n",
+                  argv[0]);
+        return 1;
+    }
+  }
+  if (num_candidates == 0 || max_threads < 1 || max_tests < 1) {
+    ::fprintf(stderr, "usage: %s [-n num_candidates] [-t max_threads] [-k max_tests]\n", argv[0]);
+    return 1;
+  }
+
+  const uint64_t bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+  vector<int> witness_counts;
+  for (int k = 1; k <= max_tests; k *= 2) {
+    witness_counts.emplace_back(k);
+  }
+  witness_counts.emplace_back(0);
+
+  ::printf("bits,witnesses,threads,cand_per_s,ns_per_exp,trial_ns,exp_ns,square_ns,speedup\n");
+  for (int bits = 16; bits <= 64; bits += 8) {
+    vector<uint64_t> candidates = RandomCandidates(bits, num_candidates);
+    for (int witnesses : witness_counts) {
+      PhaseTimes times = witnesses > 0 ? TimePhases(candidates, nullptr, witnesses) :
+                                         TimePhases(candidates, bases, 7);
+      double ns_per_exp = times.num_exps > 0 ? times.exp_ns / times.num_exps : 0.0;
+
+      double one_thread = 0.0;
+      for (int threads = 1; threads <= max_threads; threads *= 2) {
+        omp_set_num_threads(threads);
+        // warm up the thread pool
+        TimeBatch(vector<uint64_t>(candidates.begin(), candidates.begin() + 1), witnesses);
+        double seconds = TimeBatch(candidates, witnesses);
+        one_thread = threads == 1 ? seconds : one_thread;
+        ::printf("%d,%d,%d,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f\n", bits, witnesses, threads,
+                 num_candidates / seconds, ns_per_exp, times.trial_ns / num_candidates,
+                 times.exp_ns / num_candidates, times.square_ns / num_candidates,
+                 one_thread / seconds);
+        ::fflush(stdout);
+      }
+    }
+  }
+  return 0;
+}
@@ -49,5 +49,96 @@ void TestMillerRobin() {
   assert(false == para::MillerRobin(46856248255981, 4));
   ::printf("%ld passed\n", 46856248255981);
 
+  // 2^61 - 1, a strong pseudoprime to the bases 2..23, the largest prime below
+  // 2^64 and 2^64 - 1
+  assert(true == para::MillerRobin(2305843009213693951ULL, 4));
+  ::printf("%llu passed\n", 2305843009213693951ULL);
+
+  assert(false == para::MillerRobin(3825123056546413051ULL, 8));
+  ::printf("%llu passed\n", 3825123056546413051ULL);
+
+  assert(true == para::MillerRobin(18446744073709551557ULL, 4));
+  ::printf("%llu passed\n", 18446744073709551557ULL);
+
+  assert(false == para::MillerRobin(18446744073709551615ULL, 4));
+  ::printf("%llu passed\n", 18446744073709551615ULL);
+
 }
 
+void TestMillerRobinBatch() {
+  // compare against trial division, Carmichael numbers included
+  vector<uint64_t> candidates;
+  for (uint64_t x = 0; x < 20000; ++x) {
+    candidates.emplace_back(x);
+  }
+  candidates.emplace_back(100000000063);
+  candidates.emplace_back(46856248255981);
+
+  vector<uint64_t> is_prime;
+  para::MillerRobinBatch(candidates.data(), candidates.size(), 20, &is_prime);
+  assert(is_prime.size() == (candidates.size() + 63) / 64);
+  for (size_t i = 0; i + 2 < candidates.size(); ++i) {
+    uint64_t x = candidates[i];
+    bool expected = x >= 2;
+    for (uint64_t d = 2; d * d <= x && expected; ++d) {
+      expected = x % d != 0;
+    }
+    assert(expected == bool((is_prime[i / 64] >> (i % 64)) & 1));
+  }
+  size_t last = candidates.size() - 1;
+  assert(true == bool((is_prime[(last - 1) / 64] >> ((last - 1) % 64)) & 1));
+  assert(false == bool((is_prime[last / 64] >> (last % 64)) & 1));
+  ::printf("batch of %zu passed\n", candidates.size());
+}
+
+void TestFastExponential() {
+  assert(2 == para::FastExponential(2, 10, 7));
+  assert(0 == para::FastExponential(5, 3, 1));
+  assert(1 == para::FastExponential(3, 18446744073709551556ULL, 18446744073709551557ULL));
+  assert(16343307752298083825ULL ==
+         para::FastExponential(12345678901234567ULL, 18446744073709551614ULL, 18446744073709551557ULL));
+  // even modulus
+  assert(11741682936801109145ULL ==
+         para::FastExponential(7, 9223372036854775809ULL, 18446744073709551614ULL));
+  assert(16140901064495857703ULL ==
+         para::FastMultiply(9223372036854775813ULL, 4611686018427387911ULL, 18446744073709551615ULL));
+  ::printf("FastExponential and FastMultiply passed\n");
+}
+
+void TestMillerRobinDeterministic() {
+  uint64_t primes[] = {2, 3, 97, 101, 10007, 100000000063ULL, 2305843009213693951ULL,
+                       18446744073709551557ULL};
+  // Carmichael numbers, squares of primes, strong pseudoprimes to the bases
+  // 2..7 and 2..23, a product of two primes near 2^32, and 2^64 - 1
+  uint64_t composites[] = {0, 1, 4, 341, 561, 10201, 75361, 3215031751ULL, 1000006000009ULL,
+                           46856248255981ULL, 3825123056546413051ULL, 18446743979220271189ULL,
+                           18446744073709551615ULL};
+  for (auto x : primes) {
+    assert(true == para::MillerRobinDeterministic(x));
+  }
+  for (auto x : composites) {
+    assert(false == para::MillerRobinDeterministic(x));
+  }
+
+  vector<uint64_t> candidates;
+  for (uint64_t x = 0; x < 20000; ++x) {
+    candidates.emplace_back(x);
+  }
+  for (uint64_t x = (1ULL << 62) - 1000; x < (1ULL << 62); ++x) {
+    candidates.emplace_back(x);
+  }
+  vector<uint64_t> is_prime, is_prime_again, is_prime_random;
+  para::MillerRobinDeterministicBatch(candidates.data(), candidates.size(), &is_prime);
+  para::MillerRobinDeterministicBatch(candidates.data(), candidates.size(), &is_prime_again);
+  para::MillerRobinBatch(candidates.data(), candidates.size(), 20, &is_prime_random);
+  assert(is_prime == is_prime_again);
+  assert(is_prime == is_prime_random);
+  for (uint64_t x = 0; x < 20000; ++x) {
+    bool expected = x >= 2;
+    for (uint64_t d = 2; d * d <= x && expected; ++d) {
+      expected = x % d != 0;
+    }
+    assert(expected == bool((is_prime[x / 64] >> (x % 64)) & 1));
+  }
+  ::printf("deterministic test passed\n");
+}
@@ -6,154 +6,805 @@
 
 #include "page_rank.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+#include <limits>
+
 namespace para {
 
-PageRanker::PageRanker(double damping_factor_, int max_iter_, double precision_)
-    : damping_factor(damping_factor_), max_iter(max_iter_), precision(precision_) {}
+// \brief Call visit(from, to) with the uint64_t node ids of every edge of an edge list file, which is
+// read in chunks of EDGE_LIST_CHUNK_SIZE bytes.
+//
+// \return false if the file can't be read or is malformed
+template <typename Visit>
+static bool ForEachEdge(const string& edge_list_path, EdgeListFormat format, Visit visit) {
+  auto f = ::fopen(edge_list_path.c_str(), "rb");
+  if (f == nullptr) {
+    return false;
+  }
 
+  vector<char> buffer(EDGE_LIST_CHUNK_SIZE);
+  bool ok = true;
+  size_t left = 0;
+  while (ok) {
+    size_t n = left + ::fread(buffer.data() + left, 1, buffer.size() - left, f);
+    bool eof = n < buffer.size();
 
-void PageRanker::PageRank(const vector<vector<int>>& connections, vector<double>* page_rank) {
-  vector<int> csr_indptr, csr_indices;
-  vector<double> csr_data;
+    if (format == EDGE_LIST_BINARY) {
+      const size_t edge_size = 2 * sizeof(int32_t);
+      size_t end = n / edge_size * edge_size;
+      for (size_t i = 0; i < end; i += edge_size) {
+        int32_t edge[2];
+        ::memcpy(edge, buffer.data() + i, edge_size);
+        if (edge[0] < 0 || edge[1] < 0) {
+          ok = false;
+          break;
+        }
+        visit(static_cast<uint64_t>(edge[0]), static_cast<uint64_t>(edge[1]));
+      }
+      left = n - end;
+      ok = ok && !(eof && left > 0);
+    } else if (format == EDGE_LIST_BINARY64) {
+      const size_t edge_size = 2 * sizeof(uint64_t);
+      size_t end = n / edge_size * edge_size;
+      for (size_t i = 0; i < end; i += edge_size) {
+        uint64_t edge[2];
+        ::memcpy(edge, buffer.data() + i, edge_size);
+        visit(edge[0], edge[1]);
+      }
+      left = n - end;
+      ok = ok && !(eof && left > 0);
+    } else {
+      // only complete lines are parsed, the rest moves to the next chunk
+      size_t end = n;
+      if (!eof) {
+        while (end > 0 && buffer[end - 1] != '\n') {
+          --end;
+        }
+        if (end == 0) {
+          // a line longer than a chunk
+          ok = false;
+          break;
+        }
+      }
+      const char* p = buffer.data();
+      const char* last = buffer.data() + end;
+      while (ok && p < last) {
+        while (p < last && (*p == ' ' || *p == '\t' || *p == '\r')) {
+          ++p;
+        }
+        if (p < last && *p != '\n' && *p != '#' && *p != '%') {
+          uint64_t ids[2];
+          for (int k = 0; k < 2 && ok; ++k) {
+            while (p < last && (*p == ' ' || *p == '\t')) {
+              ++p;
+            }
+            ok = p < last && *p >= '0' && *p <= '9';
+            ids[k] = 0;
+            while (ok && p < last && *p >= '0' && *p <= '9') {
+              ok = ids[k] <= (UINT64_MAX - 9) / 10;
+              ids[k] = ids[k] * 10 + (*p++ - '0');
+            }
+          }
+          if (ok) {
+            visit(ids[0], ids[1]);
+          }
+        }
+        // skip the rest of the line
+        while (p < last && *p++ != '\n') {}
+      }
+      left = n - end;
+    }
 
-  Connections2CSRMatrix(connections, &csr_indptr, &csr_indices, &csr_data);
+    if (eof) {
+      break;
+    }
+    ::memmove(buffer.data(), buffer.data() + n - left, left);
+  }
 
-  PowerMethodPR(csr_indptr, csr_indices, csr_data, page_rank);
+  ok = ok && !::ferror(f);
+  ::fclose(f);
+  return ok;
 }
 
+// \return x rounded up to a multiple of 8
+static uint64_t Align8(uint64_t x) {
+  return (x + 7) / 8 * 8;
+}
 
-void PageRanker::Connections2CSRMatrix(const vector<vector<int>>& connections, vector<int>* csr_indptr,
-                                       vector<int>* csr_indices, vector<double>* csr_data) {
-  vector<vector<int>> conns {connections};
+template <typename Offset, typename Index>
+BasicCSRGraph<Offset, Index>::~BasicCSRGraph() {
+  Clear();
+}
 
-  auto less_than_ = [](const vector<int>& v1, const vector<int>& v2) -> bool {
-    if (v1[0] > v2[0])
-      return false;
-    else if (v1[0] == v2[0])
-      return v1[1] < v2[1];
-    else
-      return true;
-  };
+template <typename Offset, typename Index>
+void BasicCSRGraph<Offset, Index>::Clear() {
+  if (mapped != nullptr) {
+    ::munmap(mapped, mapped_size);
+    mapped = nullptr;
+    mapped_size = 0;
+  }
+  vector<Offset>().swap(indptr_storage);
+  vector<Index>().swap(indices_storage);
+  vector<Offset>().swap(out_degree_storage);
+  num_nodes_ = 0;
+  num_nonzeros_ = 0;
+  indptr_ = out_degree_ = nullptr;
+  indices_ = nullptr;
+}
 
-  std::sort(conns.begin(), conns.end(), less_than_);
+template <typename Offset, typename Index>
+void BasicCSRGraph<Offset, Index>::UseStorage() {
+  num_nodes_ = out_degree_storage.size();
+  num_nonzeros_ = indices_storage.size();
+  indptr_ = indptr_storage.data();
+  indices_ = indices_storage.data();
+  out_degree_ = out_degree_storage.data();
+}
 
-  int max_node_id = conns.back()[0];
+template <typename Offset, typename Index>
+bool BasicCSRGraph<Offset, Index>::Load(const string& path) {
+  Clear();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CSRFileHeader))) {
+    ::close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps the file alive
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  mapped = addr;
+  mapped_size = size;
 
-  vector<int> nodes_outs(conns.back()[0]+1, 0);
-  for (const auto& v : conns) {
-    ++nodes_outs[v[0]];
+  // every array must lie inside the file, aligned
+  CSRFileHeader header;
+  ::memcpy(&header, addr, sizeof(header));
+  auto fits = [size](uint64_t offset, uint64_t count, uint64_t entry_size) {
+    return offset % 8 == 0 && offset >= sizeof(CSRFileHeader) && offset <= size &&
+           count <= (size - offset) / entry_size;
+  };
+  bool ok = header.magic == CSR_FILE_MAGIC && header.version == CSR_FILE_VERSION &&
+            header.offset_size == sizeof(Offset) && header.index_size == sizeof(Index) &&
+            header.num_nodes > 0 && header.num_nodes <= std::numeric_limits<Index>::max() &&
+            header.num_nonzeros <= std::numeric_limits<Offset>::max() &&
+            fits(header.indptr_offset, header.num_nodes + 1, sizeof(Offset)) &&
+            fits(header.indices_offset, header.num_nonzeros, sizeof(Index)) &&
+            fits(header.out_degree_offset, header.num_nodes, sizeof(Offset));
+  if (!ok) {
+    Clear();
+    return false;
   }
 
-  auto less_than_by_2_ = [](const vector<int>& v1, const vector<int>& v2) -> bool {
-    if (v1[1] > v2[1])
-      return false;
-    else if (v1[1] == v2[1])
-      return v1[0] < v2[0];
-    else
-      return true;
+  const char* base = static_cast<const char*>(addr);
+  num_nodes_ = header.num_nodes;
+  num_nonzeros_ = header.num_nonzeros;
+  indptr_ = reinterpret_cast<const Offset*>(base + header.indptr_offset);
+  indices_ = reinterpret_cast<const Index*>(base + header.indices_offset);
+  out_degree_ = reinterpret_cast<const Offset*>(base + header.out_degree_offset);
+  if (indptr_[0] != 0 || indptr_[num_nodes_] != num_nonzeros_) {
+    Clear();
+    return false;
+  }
+  return true;
+}
+
+template <typename Offset, typename Index>
+bool BasicCSRGraph<Offset, Index>::Save(const string& path) const {
+  uint64_t num_nodes = num_nodes_;
+  uint64_t num_nonzeros = num_nonzeros_;
+  CSRFileHeader header;
+  ::memset(&header, 0, sizeof(header));
+  header.magic = CSR_FILE_MAGIC;
+  header.version = CSR_FILE_VERSION;
+  header.offset_size = sizeof(Offset);
+  header.index_size = sizeof(Index);
+  header.num_nodes = num_nodes;
+  header.num_nonzeros = num_nonzeros;
+  header.indptr_offset = Align8(sizeof(header));
+  header.indices_offset = Align8(header.indptr_offset + (num_nodes + 1) * sizeof(Offset));
+  header.out_degree_offset = Align8(header.indices_offset + num_nonzeros * sizeof(Index));
+
+  auto f = ::fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    return false;
+  }
+  const char padding[8] = {0};
+  uint64_t written = 0;
+  auto write = [&](const void* data, uint64_t offset, uint64_t bytes) {
+    bool ok = ::fwrite(padding, 1, offset - written, f) == offset - written &&
+              ::fwrite(data, 1, bytes, f) == bytes;
+    written = offset + bytes;
+    return ok;
   };
-  
-  std::sort(conns.begin(), conns.end(), less_than_by_2_);
-  max_node_id = max_node_id > conns.back()[1] ? max_node_id : conns.back()[1];
-  
-  csr_indptr->clear();
-  csr_indices->clear();
-  csr_data->clear();
+  bool ok = write(&header, 0, sizeof(header)) &&
+            write(indptr_, header.indptr_offset, (num_nodes + 1) * sizeof(Offset)) &&
+            write(indices_, header.indices_offset, num_nonzeros * sizeof(Index)) &&
+            write(out_degree_, header.out_degree_offset, num_nodes * sizeof(Offset));
+  ok = ::fclose(f) == 0 && ok;
+  return ok;
+}
+
+PageRanker::PageRanker(double damping_factor_, int max_iter_, double precision_,
+                       PageRankSolver solver_, PageRankOrdering ordering_)
+    : damping_factor(damping_factor_), max_iter(max_iter_), precision(precision_),
+      solver(solver_), ordering(ordering_) {}
+
+
+void PageRanker::PageRank(const vector<vector<int>>& connections, vector<double>* page_rank) {
+  CSRGraph graph;
+  BuildGraph(connections, &graph);
+
+  Solve(graph, page_rank);
+}
+
 
-  int node_id = 0;
-  int num_nonzeros = 0;
-  csr_indptr->emplace_back(num_nonzeros);
+bool PageRanker::PageRank(const string& edge_list_path, EdgeListFormat format,
+                          vector<double>* page_rank) {
+  CSRGraph graph;
+  if (!BuildGraph(edge_list_path, format, &graph)) {
+    return false;
+  }
+
+  Solve(graph, page_rank);
+  return true;
+}
+
+
+template <typename Offset, typename Index>
+void PageRanker::PageRank(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank) {
+  Solve(graph, page_rank);
+}
+
+
+template <typename Offset, typename Index>
+void PageRanker::BuildGraph(const vector<vector<int>>& connections,
+                            BasicCSRGraph<Offset, Index>* graph) {
+  graph->Clear();
+  Connections2CSRMatrix(connections, &graph->indptr_storage, &graph->indices_storage,
+                        &graph->out_degree_storage);
+  graph->UseStorage();
+}
 
-  for (int i = 0; i < conns.size();) {
-    // no incidence to node_id
-    while (conns[i][1] > node_id) {
-      csr_indptr->emplace_back(num_nonzeros);
-      ++node_id;
+
+template <typename Offset, typename Index>
+bool PageRanker::BuildGraph(const string& edge_list_path, EdgeListFormat format,
+                            BasicCSRGraph<Offset, Index>* graph) {
+  graph->Clear();
+  if (!EdgeList2CSRMatrix(edge_list_path, format, &graph->indptr_storage,
+                          &graph->indices_storage, &graph->out_degree_storage)) {
+    graph->Clear();
+    return false;
+  }
+  graph->UseStorage();
+  return true;
+}
+
+
+template <typename Offset, typename Index>
+bool PageRanker::EdgeList2CSRMatrix(const string& edge_list_path, EdgeListFormat format,
+                                    vector<Offset>* csr_indptr, vector<Index>* csr_indices,
+                                    vector<Offset>* nodes_outs) {
+  // pass 1: in degree goes to csr_indptr, shifted by one, and out degree to nodes_outs
+  nodes_outs->clear();
+  csr_indptr->assign(1, 0);
+  uint64_t num_nonzeros = 0;
+  bool fits = true;
+  bool ok = ForEachEdge(edge_list_path, format, [&](uint64_t from, uint64_t to) {
+    uint64_t max_id = from > to ? from : to;
+    // num_nodes = max_id + 1 must be an Index too
+    if (max_id >= std::numeric_limits<Index>::max()) {
+      fits = false;
+      return;
     }
+    if (max_id >= nodes_outs->size()) {
+      nodes_outs->resize(max_id + 1, 0);
+      csr_indptr->resize(max_id + 2, 0);
+    }
+    ++(*nodes_outs)[from];
+    ++(*csr_indptr)[to + 1];
+    ++num_nonzeros;
+  });
+  if (!ok || !fits || num_nonzeros > std::numeric_limits<Offset>::max() ||
+      nodes_outs->empty()) {
+    return false;
+  }
+
+  size_t num_nodes = nodes_outs->size();
+  for (size_t i = 0; i < num_nodes; ++i) {
+    (*csr_indptr)[i + 1] += (*csr_indptr)[i];
+  }
 
-    // consume all nodes with incidence to node_id
-    while(i < conns.size() && conns[i][1] == node_id) {
-      ++num_nonzeros;
-      csr_indices->emplace_back(conns[i][0]);
-      csr_data->emplace_back(1.0 / nodes_outs[conns[i][0]]);
-      ++i;
+  // pass 2: every edge goes to the next free slot of its row
+  vector<Offset> next(csr_indptr->begin(), csr_indptr->end() - 1);
+  csr_indices->assign(num_nonzeros, 0);
+  uint64_t num_seen = 0;
+  ok = ForEachEdge(edge_list_path, format, [&](uint64_t from, uint64_t to) {
+    // the file may have changed in between
+    if (to < num_nodes && from < num_nodes && next[to] < (*csr_indptr)[to + 1]) {
+      (*csr_indices)[next[to]++] = from;
     }
-    csr_indptr->emplace_back(num_nonzeros);
-    ++node_id;
+    ++num_seen;
+  });
+  return ok && num_seen == num_nonzeros;
+}
+
+
+template <typename Offset, typename Index>
+void PageRanker::Connections2CSRMatrix(const vector<vector<int>>& connections,
+                                       vector<Offset>* csr_indptr, vector<Index>* csr_indices,
+                                       vector<Offset>* nodes_outs) {
+  int64_t num_nonzeros = connections.size();
+
+  int max_node_id = -1;
+  #pragma omp parallel for reduction(max:max_node_id)
+  for (int64_t e = 0; e < num_nonzeros; ++e) {
+    int max_id = connections[e][0] > connections[e][1] ? connections[e][0] : connections[e][1];
+    max_node_id = max_node_id > max_id ? max_node_id : max_id;
   }
+  int64_t num_nodes = max_node_id + 1;
+
+  // Counting sort by target. Every thread counts the edges of its slice in
+  // its own histograms, so no atomics are needed, and then writes them to
+  // the rows after the edges of the threads before it, so the result is the
+  // same for any number of threads.
+  int max_threads = omp_get_max_threads();
+  vector<Offset> in_counts(static_cast<size_t>(max_threads) * num_nodes);
+  vector<Offset> out_counts(static_cast<size_t>(max_threads) * num_nodes);
+  nodes_outs->assign(num_nodes, 0);
+  csr_indptr->assign(num_nodes + 1, 0);
+  csr_indices->resize(num_nonzeros);
 
-  // no incidence to node_id
-  while (max_node_id >= node_id) {
-    csr_indptr->emplace_back(num_nonzeros);
-    ++node_id;
+  #pragma omp parallel num_threads(max_threads)
+  {
+    int tid = omp_get_thread_num();
+    int num_threads = omp_get_num_threads();
+    int64_t first = num_nonzeros * tid / num_threads;
+    int64_t last = num_nonzeros * (tid + 1) / num_threads;
+    Offset* in_count = in_counts.data() + static_cast<size_t>(tid) * num_nodes;
+    Offset* out_count = out_counts.data() + static_cast<size_t>(tid) * num_nodes;
+    std::fill(in_count, in_count + num_nodes, 0);
+    std::fill(out_count, out_count + num_nodes, 0);
+
+    for (int64_t e = first; e < last; ++e) {
+      ++out_count[connections[e][0]];
+      ++in_count[connections[e][1]];
+    }
+    #pragma omp barrier
+
+    // in_counts become the offset of every thread inside a row
+    #pragma omp for
+    for (int64_t i = 0; i < num_nodes; ++i) {
+      Offset row_length = 0, outs = 0;
+      for (int t = 0; t < num_threads; ++t) {
+        Offset count = in_counts[static_cast<size_t>(t) * num_nodes + i];
+        in_counts[static_cast<size_t>(t) * num_nodes + i] = row_length;
+        row_length += count;
+        outs += out_counts[static_cast<size_t>(t) * num_nodes + i];
+      }
+      (*csr_indptr)[i + 1] = row_length;
+      (*nodes_outs)[i] = outs;
+    }
+
+    #pragma omp single
+    for (int64_t i = 0; i < num_nodes; ++i) {
+      (*csr_indptr)[i + 1] += (*csr_indptr)[i];
+    }
+
+    for (int64_t e = first; e < last; ++e) {
+      int to = connections[e][1];
+      (*csr_indices)[(*csr_indptr)[to] + in_count[to]++] = connections[e][0];
+    }
   }
+}
+
+// \brief Split the rows into num_parts ranges of about the same work, the
+// non-zeros plus the rows in them, by binary search on csr_indptr.
+//
+// \param split_heavy leave the rows with more non-zeros than half a range
+// out of the ranges, so all parts can share them
+// \param row_begin first row of every range, then num_nodes, returning param
+// \param heavy_rows the rows left out, ascending, returning param
+template <typename Offset, typename Index>
+static void BalanceRows(const Offset* csr_indptr, const int64_t num_nodes, const int num_parts,
+                        const bool split_heavy, vector<int64_t>* row_begin,
+                        vector<Index>* heavy_rows) {
+  uint64_t work = static_cast<uint64_t>(csr_indptr[num_nodes]) + num_nodes;
+  uint64_t threshold = split_heavy && num_parts > 1 ? work / num_parts / 2 : UINT64_MAX;
 
+  // non-zeros of the heavy rows before every heavy row, and in all of them
+  vector<uint64_t> heavy_before(1, 0);
+  heavy_rows->clear();
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    uint64_t length = csr_indptr[i + 1] - csr_indptr[i];
+    if (length > threshold) {
+      heavy_rows->emplace_back(i);
+      heavy_before.emplace_back(heavy_before.back() + length);
+    }
+  }
+
+  // work of the rows before row i, without the heavy non-zeros
+  auto work_before = [&](int64_t i) {
+    size_t k = std::lower_bound(heavy_rows->begin(), heavy_rows->end(), i) -
+               heavy_rows->begin();
+    return csr_indptr[i] - heavy_before[k] + i;
+  };
+  uint64_t light_work = work - heavy_before.back();
+  row_begin->resize(num_parts + 1);
+  for (int p = 0; p < num_parts; ++p) {
+    uint64_t target = light_work * p / num_parts;
+    int64_t low = 0, high = num_nodes;
+    while (low < high) {
+      int64_t mid = low + (high - low) / 2;
+      if (work_before(mid) < target) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    (*row_begin)[p] = low;
+  }
+  (*row_begin)[num_parts] = num_nodes;
 }
 
-void PageRanker::PowerMethodPR(const vector<int>& csr_indptr, const vector<int>& csr_indices,
-                               const vector<double>& csr_data, vector<double>* page_rank) {
-  int num_nodes = csr_indptr.size() - 1;
+template <typename Offset, typename Index>
+void PageRanker::PowerMethodPR(const BasicCSRGraph<Offset, Index>& graph,
+                               vector<double>* page_rank) {
+  int64_t num_nodes = graph.num_nodes();
+  const Offset* csr_indptr = graph.indptr();
+  const Index* csr_indices = graph.indices();
+  const Offset* out_degree = graph.out_degree();
 
+  // weight of the links of every node
+  vector<double> inv_out(num_nodes);
   // init vector
   vector<double> u(num_nodes, 1.0 / num_nodes);
-  
-  // records the position of nodes that have no out links
-  vector<int> nodes_without_outlinks;
-  {  
-    vector<bool> nodes_(num_nodes, false); 
-    for (int i : csr_indices){
-      nodes_[i] = true;
-    }
-    for (int i = 0; i < nodes_.size(); ++i) {
-      if (nodes_[i] == false) {
-        nodes_without_outlinks.emplace_back(i);
+  // u scaled by the inverse out degrees, and the one of the next iteration
+  vector<double> scaled_u(num_nodes), next_scaled_u(num_nodes);
+  // the rank of the nodes that have no out links
+  double sum_pr_without_outlinks = 0.0;
+  #pragma omp parallel for reduction(+:sum_pr_without_outlinks)
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    inv_out[i] = out_degree[i] > 0 ? 1.0 / out_degree[i] : 0.0;
+    scaled_u[i] = inv_out[i] * u[i];
+    sum_pr_without_outlinks += out_degree[i] == 0 ? u[i] : 0.0;
+  }
+
+  // Every thread takes about the same number of non-zeros. The rows of hubs
+  // too long for that are summed by all threads, each over a slice, first.
+  int num_parts = omp_get_max_threads();
+  vector<int64_t> row_begin;
+  vector<Index> heavy_rows;
+  BalanceRows(csr_indptr, num_nodes, num_parts, true, &row_begin, &heavy_rows);
+  size_t num_heavy = heavy_rows.size();
+  // sum of every slice of the heavy rows
+  vector<double> heavy_sums(num_parts * num_heavy);
+
+  double max_change = 1.0;
+  for (num_iter = 0; num_iter < max_iter && max_change > precision; ++num_iter) {
+    // One pass does the matrix-vector multiplication, the change and the
+    // scaling and dangling rank of the next iteration. Row i reads nothing of
+    // u but u[i], so u is updated in place.
+    double next_sum_without_outlinks = 0.0;
+    max_change = 0.0;
+    #pragma omp parallel num_threads(num_parts) \
+        reduction(max:max_change) reduction(+:next_sum_without_outlinks)
+    {
+      int tid = omp_get_thread_num();
+      int num_threads = omp_get_num_threads();
+      if (num_heavy > 0) {
+        for (int part = tid; part < num_parts; part += num_threads) {
+          for (size_t k = 0; k < num_heavy; ++k) {
+            Offset start = csr_indptr[heavy_rows[k]];
+            uint64_t length = csr_indptr[heavy_rows[k] + 1] - start;
+            double sum_j = 0.0;
+            for (Offset j = start + length * part / num_parts;
+                 j < start + length * (part + 1) / num_parts; ++j) {
+              sum_j += scaled_u[csr_indices[j]];
+            }
+            heavy_sums[part * num_heavy + k] = sum_j;
+          }
+        }
+        #pragma omp barrier
+      }
+
+      for (int part = tid; part < num_parts; part += num_threads) {
+        for (int64_t i = row_begin[part]; i < row_begin[part + 1]; ++i) {
+          double sum_j = 0.0;
+          auto heavy = std::lower_bound(heavy_rows.begin(), heavy_rows.end(), i);
+          if (heavy != heavy_rows.end() && *heavy == i) {
+            for (int p = 0; p < num_parts; ++p) {
+              sum_j += heavy_sums[p * num_heavy + (heavy - heavy_rows.begin())];
+            }
+          } else {
+            for (Offset j = csr_indptr[i]; j < csr_indptr[i+1]; ++j) {
+              sum_j += scaled_u[csr_indices[j]];
+            }
+          }
+          sum_j += sum_pr_without_outlinks / num_nodes;
+          double v = sum_j * damping_factor + (1.0 - damping_factor) / num_nodes;
+
+          double change = u[i] - v > 0.0 ? u[i] - v : v - u[i];
+          max_change = max_change > change ? max_change : change;
+          u[i] = v;
+          next_scaled_u[i] = inv_out[i] * v;
+          next_sum_without_outlinks += inv_out[i] == 0.0 ? v : 0.0;
+        }
       }
     }
+
+    scaled_u.swap(next_scaled_u);
+    sum_pr_without_outlinks = next_sum_without_outlinks;
   }
-  
-  vector<double> v {u};
+
+  // swap memory
+  page_rank->swap(u);
+}
+
+template <typename Offset, typename Index>
+void PageRanker::GaussSeidelPR(const BasicCSRGraph<Offset, Index>& graph,
+                               vector<double>* page_rank) {
+  int64_t num_nodes = graph.num_nodes();
+  const Offset* csr_indptr = graph.indptr();
+  const Index* csr_indices = graph.indices();
+  const Offset* out_degree = graph.out_degree();
+
+  // z[j] = x[j] / out degree of j, or x[j] for the nodes without out links,
+  // which no row reads
+  vector<double> z(num_nodes);
+  #pragma omp parallel for
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    z[i] = out_degree[i] > 0 ? 1.0 / num_nodes / out_degree[i] : 1.0 / num_nodes;
+  }
+  double sum_pr_without_outlinks = 0.0;
+  #pragma omp parallel for reduction(+:sum_pr_without_outlinks)
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    sum_pr_without_outlinks += out_degree[i] == 0 ? z[i] : 0.0;
+  }
+
+  // every thread takes about the same number of non-zeros; the rows stay
+  // whole, as they are updated in place
+  int num_parts = omp_get_max_threads();
+  vector<int64_t> row_begin;
+  vector<Index> heavy_rows;
+  BalanceRows(csr_indptr, num_nodes, num_parts, false, &row_begin, &heavy_rows);
 
   double max_change = 1.0;
-  for (int iter = 0; iter < max_iter && max_change > precision; ++iter) {
-    double sum_pr_without_outlinks = 0.0;
-    for (int i : nodes_without_outlinks) {
-      sum_pr_without_outlinks += u[i];
+  for (num_iter = 0; num_iter < max_iter && max_change > precision; ++num_iter) {
+    double base = damping_factor * sum_pr_without_outlinks / num_nodes +
+                  (1.0 - damping_factor) / num_nodes;
+    max_change = 0.0;
+    double sum_pr = 0.0;
+    double next_sum_without_outlinks = 0.0;
+    #pragma omp parallel num_threads(num_parts) \
+        reduction(max:max_change) reduction(+:sum_pr,next_sum_without_outlinks)
+    for (int part = omp_get_thread_num(); part < num_parts; part += omp_get_num_threads()) {
+      for (int64_t i = row_begin[part]; i < row_begin[part + 1]; ++i) {
+        double sum_j = 0.0;
+        Offset self_links = 0;
+        for (Offset j = csr_indptr[i]; j < csr_indptr[i+1]; ++j) {
+          Index node = csr_indices[j];
+          if (node == i) {
+            ++self_links;
+            continue;
+          }
+          double z_j;
+          #pragma omp atomic read
+          z_j = z[node];
+          sum_j += z_j;
+        }
+        // x[i] appears on both sides with a self link
+        double x = (damping_factor * sum_j + base) /
+                   (1.0 - damping_factor * self_links / (out_degree[i] > 0 ? out_degree[i] : 1));
+        double old_x = out_degree[i] > 0 ? z[i] * out_degree[i] : z[i];
+        #pragma omp atomic write
+        z[i] = out_degree[i] > 0 ? x / out_degree[i] : x;
+
+        double change = x - old_x > 0.0 ? x - old_x : old_x - x;
+        max_change = max_change > change ? max_change : change;
+        sum_pr += x;
+        next_sum_without_outlinks += out_degree[i] == 0 ? x : 0.0;
+      }
     }
 
-    // do the matrix-vector multiplication
-    //double sum_pr = 0.0;
+    // the sweep doesn't keep the sum at 1
     #pragma omp parallel for
-    for (int i = 0; i < num_nodes; ++i) {
-      int start = csr_indptr[i];
-      int length = csr_indptr[i+1] - csr_indptr[i];
+    for (int64_t i = 0; i < num_nodes; ++i) {
+      z[i] /= sum_pr;
+    }
+    sum_pr_without_outlinks = next_sum_without_outlinks / sum_pr;
+  }
+
+  #pragma omp parallel for
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    z[i] = out_degree[i] > 0 ? z[i] * out_degree[i] : z[i];
+  }
+
+  page_rank->swap(z);
+}
 
-      double sum_j = 0.0;
-      for(int j = csr_indptr[i]; j < csr_indptr[i+1]; ++j) {
-        sum_j += csr_data[j] * u[csr_indices[j]];
+template <typename Offset, typename Index>
+void PageRanker::Solve(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank) {
+  if (ordering == PAGE_RANK_ORDER_NONE) {
+    RunSolver(graph, page_rank);
+    return;
+  }
+
+  BasicCSRGraph<Offset, Index> reordered;
+  vector<Index> new_to_old;
+  ReorderGraph(graph, &reordered, &new_to_old);
+  vector<double> reordered_rank;
+  RunSolver(reordered, &reordered_rank);
+
+  int64_t num_nodes = graph.num_nodes();
+  page_rank->resize(num_nodes);
+  #pragma omp parallel for
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    (*page_rank)[new_to_old[i]] = reordered_rank[i];
+  }
+}
+
+template <typename Offset, typename Index>
+void PageRanker::RunSolver(const BasicCSRGraph<Offset, Index>& graph,
+                           vector<double>* page_rank) {
+  if (solver == PAGE_RANK_GAUSS_SEIDEL) {
+    GaussSeidelPR(graph, page_rank);
+  } else {
+    PowerMethodPR(graph, page_rank);
+  }
+}
+
+// \brief Reverse Cuthill-McKee order of a graph taken without directions.
+// Every connected component is visited breadth first from a node of least
+// degree, the neighbors of a node in order of increasing degree.
+//
+// \param degree in + out degree of every node
+// \param new_to_old node of every position, returning param
+template <typename Offset, typename Index>
+static void RCMOrder(const BasicCSRGraph<Offset, Index>& graph, const vector<Offset>& degree,
+                     vector<Index>* new_to_old) {
+  int64_t num_nodes = graph.num_nodes();
+  const Offset* csr_indptr = graph.indptr();
+  const Index* csr_indices = graph.indices();
+  const Offset* out_degree = graph.out_degree();
+
+  // the out links, the rows of the transpose
+  vector<Offset> out_indptr(num_nodes + 1, 0);
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    out_indptr[i + 1] = out_indptr[i] + out_degree[i];
+  }
+  vector<Index> out_indices(graph.num_nonzeros());
+  {
+    vector<Offset> next(out_indptr.begin(), out_indptr.end() - 1);
+    for (int64_t i = 0; i < num_nodes; ++i) {
+      for (Offset j = csr_indptr[i]; j < csr_indptr[i+1]; ++j) {
+        out_indices[next[csr_indices[j]]++] = i;
       }
-      sum_j += sum_pr_without_outlinks / num_nodes; 
-      v[i] = sum_j * damping_factor + (1.0 - damping_factor) / num_nodes;
-      //#pragma omp atomic
-      //sum_pr += v[i];
     }
+  }
 
-    // from u to v
-    max_change = 0.0;
-    #pragma omp parallel for
-    for (int i = 0; i < num_nodes; ++i) {
-      //v[i] /= sum_pr;
+  vector<Index> by_degree(num_nodes);
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    by_degree[i] = i;
+  }
+  auto less_degree = [&degree](Index a, Index b) {
+    return degree[a] < degree[b] || (degree[a] == degree[b] && a < b);
+  };
+  std::sort(by_degree.begin(), by_degree.end(), less_degree);
+
+  vector<bool> visited(num_nodes, false);
+  new_to_old->clear();
+  new_to_old->reserve(num_nodes);
+  vector<Index> neighbors;
+  for (Index start : by_degree) {
+    if (visited[start]) {
+      continue;
+    }
+    visited[start] = true;
+    // new_to_old is the queue of the breadth first search
+    size_t head = new_to_old->size();
+    new_to_old->emplace_back(start);
+    for (; head < new_to_old->size(); ++head) {
+      Index node = (*new_to_old)[head];
+      neighbors.clear();
+      for (Offset j = csr_indptr[node]; j < csr_indptr[node + 1]; ++j) {
+        if (!visited[csr_indices[j]]) {
+          visited[csr_indices[j]] = true;
+          neighbors.emplace_back(csr_indices[j]);
+        }
+      }
+      for (Offset j = out_indptr[node]; j < out_indptr[node + 1]; ++j) {
+        if (!visited[out_indices[j]]) {
+          visited[out_indices[j]] = true;
+          neighbors.emplace_back(out_indices[j]);
+        }
+      }
+      std::sort(neighbors.begin(), neighbors.end(), less_degree);
+      new_to_old->insert(new_to_old->end(), neighbors.begin(), neighbors.end());
+    }
+  }
+  std::reverse(new_to_old->begin(), new_to_old->end());
+}
+
+template <typename Offset, typename Index>
+void PageRanker::ReorderGraph(const BasicCSRGraph<Offset, Index>& graph,
+                              BasicCSRGraph<Offset, Index>* reordered,
+                              vector<Index>* new_to_old) {
+  int64_t num_nodes = graph.num_nodes();
+  const Offset* csr_indptr = graph.indptr();
+  const Index* csr_indices = graph.indices();
+  const Offset* out_degree = graph.out_degree();
+
+  vector<Offset> degree(num_nodes);
+  #pragma omp parallel for
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    degree[i] = csr_indptr[i + 1] - csr_indptr[i] + out_degree[i];
+  }
 
-      double change = u[i] - v[i] > 0.0 ? u[i] - v[i] : v[i] - u[i];
-      #pragma omp atomic
-      max_change = max_change > change ? max_change : change;
+  if (ordering == PAGE_RANK_ORDER_RCM) {
+    RCMOrder(graph, degree, new_to_old);
+  } else {
+    new_to_old->resize(num_nodes);
+    for (int64_t i = 0; i < num_nodes; ++i) {
+      (*new_to_old)[i] = i;
     }
+    std::stable_sort(new_to_old->begin(), new_to_old->end(), [&degree](Index a, Index b) {
+      return degree[a] > degree[b];
+    });
+  }
 
-    // swap
-    u.swap(v);
+  vector<Index> old_to_new(num_nodes);
+  #pragma omp parallel for
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    old_to_new[(*new_to_old)[i]] = i;
   }
 
-  // swap memory
-  page_rank->swap(u);
+  reordered->Clear();
+  vector<Offset>& indptr = reordered->indptr_storage;
+  vector<Index>& indices = reordered->indices_storage;
+  vector<Offset>& outs = reordered->out_degree_storage;
+  indptr.assign(num_nodes + 1, 0);
+  outs.resize(num_nodes);
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    Index old = (*new_to_old)[i];
+    indptr[i + 1] = indptr[i] + csr_indptr[old + 1] - csr_indptr[old];
+    outs[i] = out_degree[old];
+  }
+  indices.resize(graph.num_nonzeros());
+  #pragma omp parallel for schedule(dynamic, 1024)
+  for (int64_t i = 0; i < num_nodes; ++i) {
+    Index old = (*new_to_old)[i];
+    Offset k = indptr[i];
+    for (Offset j = csr_indptr[old]; j < csr_indptr[old + 1]; ++j) {
+      indices[k++] = old_to_new[csr_indices[j]];
+    }
+    std::sort(indices.begin() + indptr[i], indices.begin() + indptr[i + 1]);
+  }
+  reordered->UseStorage();
 }
 
+#define INSTANTIATE_CSR_GRAPH(Offset, Index)                                              \
+  template class BasicCSRGraph<Offset, Index>;                                            \
+  template void PageRanker::PageRank(const BasicCSRGraph<Offset, Index>&, vector<double>*); \
+  template void PageRanker::BuildGraph(const vector<vector<int>>&,                        \
+                                       BasicCSRGraph<Offset, Index>*);                    \
+  template bool PageRanker::BuildGraph(const string&, EdgeListFormat,                     \
+                                       BasicCSRGraph<Offset, Index>*);
+
+INSTANTIATE_CSR_GRAPH(uint32_t, uint32_t)
+INSTANTIATE_CSR_GRAPH(uint64_t, uint32_t)
+INSTANTIATE_CSR_GRAPH(uint64_t, uint64_t)
+
 } // namespace para
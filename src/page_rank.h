@@ -9,6 +9,8 @@
 
 #include <cstdlib>
 #include <cstdint>
+#include <cstdio>
+#include <string>
 #include <vector>
 #include <algorithm>
 
@@ -18,15 +20,154 @@
 #include <omp.h>
 
 
+using std::string;
 using std::vector;
 
 namespace para {
 
+// Layout of an edge list file.
+//
+// EDGE_LIST_TEXT: one "from to" pair of node ids per line, lines starting
+//                 with '#' or '%' are comments
+// EDGE_LIST_BINARY: consecutive pairs of native int32_t from, to
+// EDGE_LIST_BINARY64: consecutive pairs of native uint64_t from, to
+enum EdgeListFormat {
+  EDGE_LIST_TEXT = 0,
+  EDGE_LIST_BINARY,
+  EDGE_LIST_BINARY64
+};
+
+// Bytes of an edge list file read at a time.
+const size_t EDGE_LIST_CHUNK_SIZE = 1 << 24;
+
+// Binary CSR file: a CSRFileHeader, then csr_indptr (num_nodes + 1 entries),
+// csr_indices (num_nonzeros entries) and the out degree of every node
+// (num_nodes entries), each array starting at a multiple of 8 bytes.
+// csr_indptr and out degree entries are offset_size bytes, node ids
+// index_size bytes. Row i holds the nodes linking to node i, as in PageRanker.
+const uint64_t CSR_FILE_MAGIC = 0x5253434b4e415250;  // "PRANKCSR"
+const uint32_t CSR_FILE_VERSION = 1;
+
+struct CSRFileHeader {
+  uint64_t magic;
+  uint32_t version;
+  // bytes per csr_indptr entry and per node id
+  uint32_t offset_size;
+  uint32_t index_size;
+  uint32_t reserved;
+  uint64_t num_nodes;
+  uint64_t num_nonzeros;
+  // byte offsets of the arrays from the start of the file
+  uint64_t indptr_offset;
+  uint64_t indices_offset;
+  uint64_t out_degree_offset;
+};
+
+// \brief Read-only CSR matrix of a graph with the out degree of every node,
+// either built by PageRanker or mapped from a binary CSR file.
+//
+// Offset is the type of csr_indptr and the out degrees, so it bounds the
+// number of edges, and Index the type of the node ids. Use the smallest
+// types the graph fits in, see the typedefs below.
+template <typename Offset, typename Index>
+class BasicCSRGraph {
+ public:
+  typedef Offset offset_type;
+  typedef Index index_type;
+
+  BasicCSRGraph() = default;
+  BasicCSRGraph(const BasicCSRGraph&) = delete;
+  BasicCSRGraph& operator=(const BasicCSRGraph&) = delete;
+
+  // unmaps the file, if any
+  ~BasicCSRGraph();
+
+  // \brief Map a binary CSR file with mmap. Nothing is parsed or copied, the
+  // arrays are read straight from the page cache.
+  //
+  // \return false if the file can't be mapped, or its magic, version or
+  // sizes don't match
+  bool Load(const string& path);
+
+  // \brief Write the graph as a binary CSR file.
+  //
+  // \return false if the file can't be written
+  bool Save(const string& path) const;
+
+  Index num_nodes() const { return num_nodes_; }
+  Offset num_nonzeros() const { return num_nonzeros_; }
+  const Offset* indptr() const { return indptr_; }
+  const Index* indices() const { return indices_; }
+  const Offset* out_degree() const { return out_degree_; }
+
+ private:
+  friend class PageRanker;
+
+  // \brief Unmap the file or drop the arrays built in memory.
+  void Clear();
+
+  // \brief Point the arrays at the storage vectors.
+  void UseStorage();
+
+  // arrays of a graph built in memory
+  vector<Offset> indptr_storage;
+  vector<Index> indices_storage;
+  vector<Offset> out_degree_storage;
+
+  // mapping of a loaded file
+  void* mapped = nullptr;
+  size_t mapped_size = 0;
+
+  Index num_nodes_ = 0;
+  Offset num_nonzeros_ = 0;
+  const Offset* indptr_ = nullptr;
+  const Index* indices_ = nullptr;
+  const Offset* out_degree_ = nullptr;
+};
+
+// up to 2^32 - 1 nodes and edges, 4 bytes per edge
+typedef BasicCSRGraph<uint32_t, uint32_t> CSRGraph;
+// up to 2^32 - 1 nodes, 64-bit edge offsets
+typedef BasicCSRGraph<uint64_t, uint32_t> LargeCSRGraph;
+// 64-bit node ids and edge offsets, 8 bytes per edge
+typedef BasicCSRGraph<uint64_t, uint64_t> HugeCSRGraph;
+
+// Iteration PageRanker solves with.
+//
+// PAGE_RANK_POWER: power method, Jacobi style, every iteration computes a
+//                  new vector from the old one
+// PAGE_RANK_GAUSS_SEIDEL: updates the values in place, so later rows of a
+//                  sweep already see the new values of earlier ones. Needs
+//                  fewer sweeps and a single vector instead of two.
+enum PageRankSolver {
+  PAGE_RANK_POWER = 0,
+  PAGE_RANK_GAUSS_SEIDEL
+};
+
+// Relabeling of the nodes before PageRanker iterates, so the values a row
+// reads lie closer together. The results are mapped back to the input ids.
+//
+// PAGE_RANK_ORDER_NONE: the input order
+// PAGE_RANK_ORDER_DEGREE: by in + out degree, highest first, so the hubs
+//                  most rows read share a few cache lines
+// PAGE_RANK_ORDER_RCM: reverse Cuthill-McKee on the graph without directions,
+//                  so linked nodes get close ids
+enum PageRankOrdering {
+  PAGE_RANK_ORDER_NONE = 0,
+  PAGE_RANK_ORDER_DEGREE,
+  PAGE_RANK_ORDER_RCM
+};
+
 class PageRanker {
  public:
-  PageRanker(double damping_factor_, int max_iter_, double precision_);
+  PageRanker(double damping_factor_, int max_iter_, double precision_,
+             PageRankSolver solver_ = PAGE_RANK_POWER,
+             PageRankOrdering ordering_ = PAGE_RANK_ORDER_NONE);
   ~PageRanker() = default;
 
+  // \return iterations (sweeps) the last PageRank() call needed
+  int num_iterations() const { return num_iter; }
+
   // \brief Calculate PageRank value of a directed graph.
   //
   // OpenMP is used to speedup.
@@ -36,41 +177,130 @@ class PageRanker {
   // \return void
   void PageRank(const vector<vector<int>>& connections, vector<double>* page_rank);
 
+  // \brief Calculate PageRank value of a directed graph stored in an edge list file.
+  //
+  // The file is streamed twice in chunks of EDGE_LIST_CHUNK_SIZE bytes, once
+  // to count the degrees and once to fill the CSR matrix, so the edges are
+  // never held in memory but in the matrix, about 4 bytes per edge.
+  //
+  // \param edge_list_path path of the edge list file
+  // \param format layout of the file
+  // \param page_rank a vector of PageRank value for every node, it's the returning value
+  // \return false if the file can't be read or is malformed, or the graph
+  // doesn't fit in a CSRGraph; build a LargeCSRGraph or HugeCSRGraph for it
+  bool PageRank(const string& edge_list_path, EdgeListFormat format, vector<double>* page_rank);
+
+  // \brief Calculate PageRank value of a graph in CSR format, e.g. mapped from
+  // a binary CSR file. The edge weights come from the out degrees, so
+  // nothing but O(V) vectors is allocated.
+  //
+  // \param page_rank a vector of PageRank value for every node, it's the returning value
+  template <typename Offset, typename Index>
+  void PageRank(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank);
+
+  // \brief Build the CSR matrix of a graph, e.g. to save it with Save().
+  //
+  // \param connections a vector of {in_id, out_id} represents the connectivity of pages
+  // \param graph the CSR matrix, it's the returning value
+  template <typename Offset, typename Index>
+  void BuildGraph(const vector<vector<int>>& connections, BasicCSRGraph<Offset, Index>* graph);
+
+  // \brief Build the CSR matrix of a graph stored in an edge list file.
+  //
+  // \return false if the file can't be read or is malformed, or the number
+  // of nodes or edges doesn't fit in Index or Offset
+  template <typename Offset, typename Index>
+  bool BuildGraph(const string& edge_list_path, EdgeListFormat format,
+                  BasicCSRGraph<Offset, Index>* graph);
+
  private:
   // \brief Convert a connection matrix into CSR format sparse matrix.
   //
   // \param connections a vector of {in_node, out_node} pair indicating the connectivity b/w nodes
   // \param csr_indptr represents rows of a sparse matrix using CSR format, returning param 
   // \param csr_indices represents col indices of non-zero values using CSR format, returning param
-  // \param csr_data values of non-zeros, returning param
+  // \param nodes_outs out degree of every node, returning param
   //
   // CSR format: csr_indptr: csr_indptr[i+1] - csr_indptr[i] represens length of non-zeros in Row i
   //             csr_indices: non-zero's col position
-  //             csr_data: contains non-zero's value 
   //
-  void Connections2CSRMatrix(const vector<vector<int>>& connections, vector<int>* csr_indptr,
-                             vector<int>* csr_indices, vector<double>* csr_data);
+  template <typename Offset, typename Index>
+  void Connections2CSRMatrix(const vector<vector<int>>& connections, vector<Offset>* csr_indptr,
+                             vector<Index>* csr_indices, vector<Offset>* nodes_outs);
+
+  // \brief Build the CSR format sparse matrix of an edge list file in two
+  // counting passes over the file. The parameters are the same as
+  // Connections2CSRMatrix().
+  //
+  // \return false if the file can't be read or is malformed, or too large
+  template <typename Offset, typename Index>
+  bool EdgeList2CSRMatrix(const string& edge_list_path, EdgeListFormat format,
+                          vector<Offset>* csr_indptr, vector<Index>* csr_indices,
+                          vector<Offset>* nodes_outs);
 
   // \brief Calculate PageRank vector using Power method.
   //
-  // \param csr_indptr represents rows of a sparse matrix using CSR format 
-  // \param csr_indices represents col indices of non-zero values using CSR format
-  // \param csr_data values of non-zeros
+  // The matrix holds the structure only: the value of a non-zero in column j
+  // is 1 / out degree of node j, so u is kept scaled by the inverse out
+  // degrees too, and the multiplication reads nothing of the matrix but
+  // csr_indptr and csr_indices. Every iteration is a single parallel pass,
+  // which computes the new values, their largest change, and the scaled
+  // vector and rank of the nodes without out links for the next iteration.
   //
-  // CSR format: csr_indptr: csr_indptr[i+1] - csr_indptr[i] represens length of non-zeros in Row i
-  //             csr_indices: non-zero's col position
-  //             csr_data: contains non-zero's value 
+  // The rows are split among the threads by non-zeros, not by count, and
+  // rows too long for one thread's share, the hubs of power law graphs, are
+  // summed by all threads, each over a slice.
   //
+  // \param graph CSR matrix of the graph
   // \param page_rank a vector containing page rank values for every node
   // \return void
-  void PowerMethodPR(const vector<int>& csr_indptr, const vector<int>& csr_indices,
-                     const vector<double>& csr_data, vector<double>* page_rank);
+  template <typename Offset, typename Index>
+  void PowerMethodPR(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank);
+
+  // \brief Calculate PageRank vector using Gauss-Seidel iteration.
+  //
+  // Every sweep computes the same rows as the power method, in place, so a
+  // row already reads the new values of the rows before it. The rank of the
+  // nodes without out links is taken from the sweep before, and the vector is
+  // scaled back to sum 1 after every sweep. Only the vector, stored divided
+  // by the out degrees, is kept.
+  //
+  // The rows are split among the OpenMP threads, which update their values
+  // in place and read whatever the others last wrote (asynchronous
+  // iteration); with one thread it's plain Gauss-Seidel.
+  //
+  // \param graph CSR matrix of the graph
+  // \param page_rank a vector containing page rank values for every node
+  template <typename Offset, typename Index>
+  void GaussSeidelPR(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank);
+
+  // \brief Calculate PageRank vector with the solver of this PageRanker, on
+  // the graph relabeled by its ordering.
+  template <typename Offset, typename Index>
+  void Solve(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank);
+
+  // \brief Calculate PageRank vector with the solver of this PageRanker.
+  template <typename Offset, typename Index>
+  void RunSolver(const BasicCSRGraph<Offset, Index>& graph, vector<double>* page_rank);
+
+  // \brief Relabel the nodes of graph by the ordering of this PageRanker.
+  // The rows of reordered are sorted, so a row reads its values in order.
+  //
+  // \param reordered the relabeled graph, returning param
+  // \param new_to_old input id of every new id, returning param
+  template <typename Offset, typename Index>
+  void ReorderGraph(const BasicCSRGraph<Offset, Index>& graph,
+                    BasicCSRGraph<Offset, Index>* reordered, vector<Index>* new_to_old);
 
  private:
 
   double damping_factor = 0.85;
   int max_iter = 29;
   double precision = 0.000000001;
+  PageRankSolver solver = PAGE_RANK_POWER;
+  PageRankOrdering ordering = PAGE_RANK_ORDER_NONE;
+  // iterations of the last call
+  int num_iter = 0;
 };
 
 
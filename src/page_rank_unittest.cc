@@ -6,6 +6,7 @@
 
 #include <cstdio>
 #include <cassert>
+#include <cmath>
 
 #include "page_rank.h"
 
@@ -35,4 +36,281 @@ void TestPageRank() {
     assert(::abs(page_rank_[i] - res_1[i]) < 0.00001);
   }
   printf("case #2 pass\n");
-}
\ No newline at end of file
+}
+void TestPageRankEdgeList() {
+  para::PageRanker page_ranker(0.85, 1000, 0.00001);
+  vector<vector<int>> connections {{0, 1}, {0, 2}, {0, 3},
+                                   {1, 3}, {2, 4}, {3, 4},
+                                   {1, 4}, {4, 0}};
+  vector<double> expected, page_rank_;
+  page_ranker.PageRank(connections, &expected);
+
+  const char* text_path = "/tmp/page_rank_test_edges.txt";
+  auto f = ::fopen(text_path, "w");
+  ::fprintf(f, "# from to\n0 1\n0\t2\r\n\n0 3\n1 3\n%% comment\n2 4\n  3 4\n1 4\n4 0");
+  ::fclose(f);
+  assert(page_ranker.PageRank(text_path, para::EDGE_LIST_TEXT, &page_rank_));
+  assert(page_rank_.size() == expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-12);
+  }
+  printf("case #1 pass\n");
+
+  const char* binary_path = "/tmp/page_rank_test_edges.bin";
+  f = ::fopen(binary_path, "wb");
+  for (const auto& c : connections) {
+    int32_t edge[2] = {c[0], c[1]};
+    ::fwrite(edge, sizeof(edge), 1, f);
+  }
+  ::fclose(f);
+  assert(page_ranker.PageRank(binary_path, para::EDGE_LIST_BINARY, &page_rank_));
+  assert(page_rank_.size() == expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-12);
+  }
+  printf("case #2 pass\n");
+
+  f = ::fopen(text_path, "w");
+  ::fprintf(f, "0 1\n1 x\n");
+  ::fclose(f);
+  assert(!page_ranker.PageRank(text_path, para::EDGE_LIST_TEXT, &page_rank_));
+  assert(!page_ranker.PageRank("/tmp/page_rank_test_missing.txt", para::EDGE_LIST_TEXT,
+                               &page_rank_));
+  ::remove(text_path);
+  ::remove(binary_path);
+  printf("case #3 pass\n");
+}
+
+void TestPageRankThreads() {
+  // random graph with hubs and nodes without out links
+  std::mt19937 generator(7);
+  vector<vector<int>> connections;
+  for (int e = 0; e < 20000; ++e) {
+    int from = generator() % 1900;
+    int to = e % 5 ? generator() % 2000 : generator() % 10;
+    connections.push_back({from, to});
+  }
+
+  para::PageRanker page_ranker(0.85, 100, 1e-12);
+  vector<double> page_rank_1, page_rank_4;
+  int max_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  page_ranker.PageRank(connections, &page_rank_1);
+  omp_set_num_threads(4);
+  page_ranker.PageRank(connections, &page_rank_4);
+  omp_set_num_threads(max_threads);
+
+  assert(page_rank_1.size() == 2000);
+  double sum = 0.0;
+  for (int i = 0; i < page_rank_1.size(); ++i) {
+    assert(std::fabs(page_rank_1[i] - page_rank_4[i]) < 1e-12);
+    sum += page_rank_1[i];
+  }
+  assert(std::fabs(sum - 1.0) < 1e-9);
+  printf("case #1 pass\n");
+}
+
+void TestPageRankCSRFile() {
+  // random graph with nodes without out links
+  std::mt19937 generator(11);
+  vector<vector<int>> connections;
+  for (int e = 0; e < 5000; ++e) {
+    connections.push_back({static_cast<int>(generator() % 450),
+                           static_cast<int>(generator() % 500)});
+  }
+  connections.push_back({499, 0});
+
+  para::PageRanker page_ranker(0.85, 100, 1e-12);
+  vector<double> expected, page_rank_;
+  page_ranker.PageRank(connections, &expected);
+
+  para::CSRGraph graph;
+  page_ranker.BuildGraph(connections, &graph);
+  assert(graph.num_nodes() == 500 && graph.num_nonzeros() == 5001);
+  page_ranker.PageRank(graph, &page_rank_);
+  assert(page_rank_.size() == expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-12);
+  }
+  printf("case #1 pass\n");
+
+  const char* csr_path = "/tmp/page_rank_test_graph.csr";
+  assert(graph.Save(csr_path));
+  para::CSRGraph mapped;
+  assert(mapped.Load(csr_path));
+  assert(mapped.num_nodes() == 500 && mapped.num_nonzeros() == 5001);
+  for (int i = 0; i <= mapped.num_nodes(); ++i) {
+    assert(mapped.indptr()[i] == graph.indptr()[i]);
+  }
+  page_ranker.PageRank(mapped, &page_rank_);
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-12);
+  }
+  printf("case #2 pass\n");
+
+  // bad magic, truncated file, missing file
+  auto f = ::fopen(csr_path, "r+b");
+  ::fputc('X', f);
+  ::fclose(f);
+  assert(!mapped.Load(csr_path));
+  assert(mapped.num_nodes() == 0);
+  f = ::fopen(csr_path, "wb");
+  ::fwrite("PRANKCSR", 1, 8, f);
+  ::fclose(f);
+  assert(!mapped.Load(csr_path));
+  assert(!mapped.Load("/tmp/page_rank_test_missing.csr"));
+  ::remove(csr_path);
+  printf("case #3 pass\n");
+}
+
+void TestPageRankIndexTypes() {
+  vector<vector<int>> connections {{0, 1}, {0, 2}, {0, 3},
+                                   {1, 3}, {2, 4}, {3, 4},
+                                   {1, 4}, {4, 0}, {5, 4}};
+  para::PageRanker page_ranker(0.85, 1000, 1e-12);
+  vector<double> expected, page_rank_;
+  page_ranker.PageRank(connections, &expected);
+
+  para::LargeCSRGraph large;
+  page_ranker.BuildGraph(connections, &large);
+  page_ranker.PageRank(large, &page_rank_);
+  assert(page_rank_.size() == expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-12);
+  }
+  printf("case #1 pass\n");
+
+  // 64-bit ids from a binary edge list, through a mapped file
+  const char* binary_path = "/tmp/page_rank_test_edges64.bin";
+  auto f = ::fopen(binary_path, "wb");
+  for (const auto& c : connections) {
+    uint64_t edge[2] = {static_cast<uint64_t>(c[0]), static_cast<uint64_t>(c[1])};
+    ::fwrite(edge, sizeof(edge), 1, f);
+  }
+  ::fclose(f);
+  para::HugeCSRGraph huge;
+  assert(page_ranker.BuildGraph(binary_path, para::EDGE_LIST_BINARY64, &huge));
+  const char* csr_path = "/tmp/page_rank_test_graph64.csr";
+  assert(huge.Save(csr_path));
+  para::HugeCSRGraph mapped;
+  assert(mapped.Load(csr_path));
+  page_ranker.PageRank(mapped, &page_rank_);
+  assert(page_rank_.size() == expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-12);
+  }
+  // the index types of the file must match
+  para::CSRGraph small;
+  assert(!small.Load(csr_path));
+  printf("case #2 pass\n");
+
+  // ids beyond 32 bits don't fit in a CSRGraph
+  const char* text_path = "/tmp/page_rank_test_edges64.txt";
+  f = ::fopen(text_path, "w");
+  ::fprintf(f, "0 1\n4294967296 0\n");
+  ::fclose(f);
+  assert(!page_ranker.PageRank(text_path, para::EDGE_LIST_TEXT, &page_rank_));
+  assert(!page_ranker.BuildGraph(text_path, para::EDGE_LIST_TEXT, &large));
+  ::remove(binary_path);
+  ::remove(csr_path);
+  ::remove(text_path);
+  printf("case #3 pass\n");
+}
+
+void TestPageRankGaussSeidel() {
+  // random graph with hubs, self links and nodes without out links
+  std::mt19937 generator(5);
+  vector<vector<int>> connections;
+  for (int e = 0; e < 20000; ++e) {
+    int from = generator() % 1900;
+    int to = e % 5 ? generator() % 2000 : generator() % 10;
+    connections.push_back({from, e % 97 ? to : from});
+  }
+
+  para::PageRanker power(0.85, 1000, 1e-13);
+  para::PageRanker gauss_seidel(0.85, 1000, 1e-13, para::PAGE_RANK_GAUSS_SEIDEL);
+  vector<double> expected, page_rank_;
+  power.PageRank(connections, &expected);
+  gauss_seidel.PageRank(connections, &page_rank_);
+  assert(page_rank_.size() == expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - expected[i]) < 1e-10);
+  }
+  assert(gauss_seidel.num_iterations() < power.num_iterations());
+  printf("case #1 pass: %d sweeps instead of %d\n", gauss_seidel.num_iterations(),
+         power.num_iterations());
+
+  vector<vector<int>> connections_1 {{0, 1}, {2, 1}};
+  vector<double> res_1 {0.212766, .574468, .212766};
+  para::PageRanker page_ranker(0.85, 1000, 0.00001, para::PAGE_RANK_GAUSS_SEIDEL);
+  page_ranker.PageRank(connections_1, &page_rank_);
+  assert(page_rank_.size() == res_1.size());
+  for (int i = 0; i < res_1.size(); ++i) {
+    assert(std::fabs(page_rank_[i] - res_1[i]) < 0.00001);
+  }
+  printf("case #2 pass\n");
+}
+
+void TestPageRankOrdering() {
+  // random graph with hubs, self links and nodes without out links
+  std::mt19937 generator(3);
+  vector<vector<int>> connections;
+  for (int e = 0; e < 20000; ++e) {
+    int from = generator() % 1900;
+    int to = e % 5 ? generator() % 2000 : generator() % 10;
+    connections.push_back({from, e % 97 ? to : from});
+  }
+  // a second component
+  connections.push_back({2001, 2002});
+  connections.push_back({2002, 2001});
+
+  para::PageRanker page_ranker(0.85, 1000, 1e-13);
+  vector<double> expected, page_rank_;
+  page_ranker.PageRank(connections, &expected);
+
+  para::PageRankOrdering orderings[] = {para::PAGE_RANK_ORDER_DEGREE, para::PAGE_RANK_ORDER_RCM};
+  para::PageRankSolver solvers[] = {para::PAGE_RANK_POWER, para::PAGE_RANK_GAUSS_SEIDEL};
+  for (auto ordering : orderings) {
+    for (auto solver : solvers) {
+      para::PageRanker reordered(0.85, 1000, 1e-13, solver, ordering);
+      reordered.PageRank(connections, &page_rank_);
+      assert(page_rank_.size() == expected.size());
+      for (int i = 0; i < expected.size(); ++i) {
+        assert(std::fabs(page_rank_[i] - expected[i]) < 1e-10);
+      }
+    }
+  }
+  printf("case #1 pass\n");
+}
+
+void TestPageRankHubs() {
+  // power law like graph: most links go to a few hubs
+  std::mt19937 generator(13);
+  vector<vector<int>> connections;
+  for (int e = 0; e < 30000; ++e) {
+    int from = generator() % 3000;
+    int to = e % 3 ? generator() % 3 : generator() % 3000;
+    connections.push_back({from, to});
+  }
+
+  para::PageRanker page_ranker(0.85, 100, 1e-12);
+  para::PageRanker gauss_seidel(0.85, 100, 1e-12, para::PAGE_RANK_GAUSS_SEIDEL);
+  vector<double> page_rank_1, page_rank_4, gauss_seidel_4;
+  int max_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  page_ranker.PageRank(connections, &page_rank_1);
+  omp_set_num_threads(4);
+  page_ranker.PageRank(connections, &page_rank_4);
+  gauss_seidel.PageRank(connections, &gauss_seidel_4);
+  omp_set_num_threads(max_threads);
+
+  assert(page_rank_4.size() == page_rank_1.size());
+  double sum = 0.0;
+  for (int i = 0; i < page_rank_1.size(); ++i) {
+    assert(std::fabs(page_rank_1[i] - page_rank_4[i]) < 1e-12);
+    assert(std::fabs(page_rank_1[i] - gauss_seidel_4[i]) < 1e-10);
+    sum += page_rank_4[i];
+  }
+  assert(std::fabs(sum - 1.0) < 1e-9);
+  printf("case #1 pass\n");
+}
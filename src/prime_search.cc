@@ -0,0 +1,112 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+
+#include "prime_search.h"
+
+#include <algorithm>
+
+#include "all_gather.h"
+
+namespace para {
+
+// \brief Hand the chunks of [begin, end) to this rank until none is left.
+// The next free chunk index lives in a window at root.
+//
+// \param callback receives the primes of every chunk this rank takes
+static int SearchChunks(const uint64_t begin, const uint64_t end, int root, MPI_Comm comm,
+                        const uint64_t chunk_size, const PrimeCallback& callback) {
+  int rank = -1;
+  ::MPI_Comm_rank(comm, &rank);
+
+  uint64_t* next_chunk = nullptr;
+  ::MPI_Win win;
+  ::MPI_Aint local_size = rank == root ? sizeof(uint64_t) : 0;
+  int ret_val = ::MPI_Win_allocate(local_size, sizeof(uint64_t), MPI_INFO_NULL, comm,
+                                   &next_chunk, &win);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  if (rank == root) {
+    *next_chunk = 0;
+  }
+  ::MPI_Barrier(comm);
+
+  uint64_t num_chunks = begin < end ? (end - begin - 1) / chunk_size + 1 : 0;
+  const uint64_t one = 1;
+  ::MPI_Win_lock_all(0, win);
+  while (true) {
+    uint64_t chunk = 0;
+    ret_val = ::MPI_Fetch_and_op(&one, &chunk, MPI_UINT64_T, root, 0, MPI_SUM, win);
+    if (ret_val != MPI_SUCCESS) {
+      break;
+    }
+    ::MPI_Win_flush(root, win);
+    if (chunk >= num_chunks) {
+      break;
+    }
+    uint64_t chunk_begin = begin + chunk * chunk_size;
+    uint64_t chunk_end = end - chunk_begin > chunk_size ? chunk_begin + chunk_size : end;
+    FindPrimes(chunk_begin, chunk_end, callback);
+  }
+  ::MPI_Win_unlock_all(win);
+
+  int free_ret_val = ::MPI_Win_free(&win);
+  return ret_val != MPI_SUCCESS ? ret_val : free_ret_val;
+}
+
+int SearchPrimeCount(const uint64_t begin, const uint64_t end, int root, MPI_Comm comm,
+                     uint64_t* count, const uint64_t chunk_size) {
+  uint64_t local_count = 0;
+  int ret_val = SearchChunks(begin, end, root, comm, chunk_size,
+                             [&local_count](const uint64_t* primes, size_t n) {
+    local_count += n;
+  });
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  return ::MPI_Reduce(&local_count, count, 1, MPI_UINT64_T, MPI_SUM, root, comm);
+}
+
+int SearchPrimes(const uint64_t begin, const uint64_t end, int root, MPI_Comm comm,
+                 vector<uint64_t>* primes, const uint64_t chunk_size) {
+  int rank = -1, size = 0;
+  ::MPI_Comm_rank(comm, &rank);
+  ::MPI_Comm_size(comm, &size);
+
+  vector<uint64_t> local_primes;
+  int ret_val = SearchChunks(begin, end, root, comm, chunk_size,
+                             [&local_primes](const uint64_t* segment, size_t n) {
+    local_primes.insert(local_primes.end(), segment, segment + n);
+  });
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  int local_count = local_primes.size();
+  vector<int> counts(size, 0), displs(size, 0);
+  ret_val = Gather(&local_count, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+  for (int p = 1; p < size; ++p) {
+    displs[p] = displs[p - 1] + counts[p - 1];
+  }
+  if (rank == root) {
+    primes->assign(displs[size - 1] + counts[size - 1], 0);
+  }
+  ret_val = Gatherv(local_primes.data(), local_count, MPI_UINT64_T, primes->data(),
+                    counts.data(), displs.data(), MPI_UINT64_T, root, comm);
+  if (ret_val != MPI_SUCCESS) {
+    return ret_val;
+  }
+
+  // chunks were taken in any order
+  if (rank == root) {
+    std::sort(primes->begin(), primes->end());
+  }
+  return MPI_SUCCESS;
+}
+
+} // namespace para
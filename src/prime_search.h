@@ -0,0 +1,48 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// Search primes in a range over all ranks of a communicator.
+
+#ifndef PRIME_SEARCH_H_
+#define PRIME_SEARCH_H_
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#include <mpi.h>
+
+#include "prime_sieve.h"
+
+using std::vector;
+
+namespace para {
+
+// Default numbers per work chunk.
+const uint64_t PRIME_SEARCH_CHUNK_SIZE = 1 << 24;
+
+// \brief Count the primes in [begin, end) with all ranks of comm.
+//
+// The range is cut into chunks of chunk_size numbers. Every rank takes the
+// next chunk from a counter at root by MPI_Fetch_and_op, so faster ranks take
+// more chunks, and searches it with the OpenMP sieve FindPrimes(). The counts
+// are reduced to root. Collective over comm.
+//
+// \param count number of primes, only valid at root. It's the returning value
+// \return MPI_SUCCESS on success
+int SearchPrimeCount(const uint64_t begin, const uint64_t end, int root, MPI_Comm comm,
+                     uint64_t* count, const uint64_t chunk_size = PRIME_SEARCH_CHUNK_SIZE);
+
+// \brief Find the primes in [begin, end) with all ranks of comm, chunked like
+// SearchPrimeCount(), and gather them to root in ascending order.
+//
+// \param primes primes, only filled at root. It's the returning value
+// \return MPI_SUCCESS on success
+int SearchPrimes(const uint64_t begin, const uint64_t end, int root, MPI_Comm comm,
+                 vector<uint64_t>* primes, const uint64_t chunk_size = PRIME_SEARCH_CHUNK_SIZE);
+
+} // namespace para
+
+
+#endif
@@ -0,0 +1,74 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// test distributed prime search
+
+
+#include "prime_search.h"
+
+#include <cassert>
+#include <cstdio>
+
+void TestSearchPrimeCount(uint64_t begin, uint64_t end, int root, uint64_t chunk_size) {
+  int rank = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  uint64_t count = 0;
+  auto ret_val = para::SearchPrimeCount(begin, end, root, MPI_COMM_WORLD, &count, chunk_size);
+  assert(ret_val == MPI_SUCCESS);
+  if (rank == root) {
+    assert(count == para::CountPrimes(begin, end));
+  }
+}
+
+void TestSearchPrimes(uint64_t begin, uint64_t end, int root, uint64_t chunk_size) {
+  int rank = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  vector<uint64_t> primes;
+  auto ret_val = para::SearchPrimes(begin, end, root, MPI_COMM_WORLD, &primes, chunk_size);
+  assert(ret_val == MPI_SUCCESS);
+  if (rank == root) {
+    vector<uint64_t> expected;
+    para::FindPrimes(begin, end, &expected);
+    assert(primes == expected);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  ::MPI_Init(&argc, &argv);
+  int rank = 0, size = 0;
+  ::MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  ::MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  if (!rank) {
+    printf("=================Test starts=================\n\n");
+    printf("Test SearchPrimeCount...\n");
+  }
+  uint64_t count = 0;
+  para::SearchPrimeCount(0, 10000000, 0, MPI_COMM_WORLD, &count);
+  assert(rank != 0 || count == 664579);
+  for (int root = 0; root < size; ++root) {
+    TestSearchPrimeCount(0, 1000000, root, 30011);
+    TestSearchPrimeCount(5, 6, root, 100);
+    TestSearchPrimeCount(10, 10, root, 100);
+  }
+  if (!rank) {
+    printf("test case pass...\n\n");
+    printf("Test SearchPrimes...\n");
+  }
+  for (int root = 0; root < size; ++root) {
+    TestSearchPrimes(0, 300000, root, 7777);
+    TestSearchPrimes(1000000000000000000ULL, 1000000000000100000ULL, root, 16384);
+    TestSearchPrimes(18446744073709551515ULL, 18446744073709551615ULL, root, 7);
+  }
+  if (!rank) {
+    printf("test case pass...\n\n");
+    printf("=================Test ends=================\n");
+  }
+
+  ::MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,146 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+
+#include "prime_sieve.h"
+
+#include <cmath>
+
+namespace para {
+
+// \return floor(sqrt(x))
+static uint64_t Sqrt(const uint64_t x) {
+  uint64_t r = static_cast<uint64_t>(std::sqrt(static_cast<long double>(x)));
+  while (r > 0 && r > x / r) {
+    --r;
+  }
+  while ((r + 1) <= x / (r + 1)) {
+    ++r;
+  }
+  return r;
+}
+
+// \brief Odd primes up to limit, by the sieve of Eratosthenes.
+static void BasePrimes(const uint64_t limit, vector<uint64_t>* primes) {
+  vector<bool> composite(limit + 1, false);
+  for (uint64_t i = 3; i <= limit; i += 2) {
+    if (composite[i]) {
+      continue;
+    }
+    primes->emplace_back(i);
+    for (uint64_t j = i * i; j <= limit; j += 2 * i) {
+      composite[j] = true;
+    }
+  }
+}
+
+// \brief Sieve the odd numbers in [low, high), low odd, and collect the primes.
+//
+// \param sieve scratch buffer of this thread
+// \param proven numbers below it without a factor up to the base primes are primes
+static void SieveSegment(const uint64_t low, const uint64_t high,
+                         const vector<uint64_t>& base_primes, const uint64_t proven,
+                         vector<uint8_t>* sieve, vector<uint64_t>* primes) {
+  size_t size = (high - low + 1) / 2;
+  sieve->assign(size, 1);
+  uint8_t* is_prime = sieve->data();
+
+  for (auto p : base_primes) {
+    uint64_t p2 = p * p;
+    if (p2 >= high) {
+      break;
+    }
+    // offset of the first odd multiple of p which is not p itself
+    uint64_t offset = 0;
+    if (p2 >= low) {
+      offset = p2 - low;
+    } else {
+      uint64_t r = low % p;
+      offset = r == 0 ? 0 : p - r;
+      if (offset & 1) {
+        offset += p;
+      }
+    }
+    for (uint64_t j = offset / 2; j < size; j += p) {
+      is_prime[j] = 0;
+    }
+  }
+
+  for (size_t j = 0; j < size; ++j) {
+    if (!is_prime[j]) {
+      continue;
+    }
+    uint64_t x = low + 2 * j;
+    if (x > 1 && (x < proven || MillerRobinDeterministic(x))) {
+      primes->emplace_back(x);
+    }
+  }
+}
+
+void FindPrimes(const uint64_t begin, const uint64_t end, const PrimeCallback& callback) {
+  if (begin >= end) {
+    return;
+  }
+  if (begin <= 2 && end > 2) {
+    uint64_t two = 2;
+    callback(&two, 1);
+  }
+
+  uint64_t first = begin | 1;
+  if (first >= end) {
+    return;
+  }
+  uint64_t limit = Sqrt(end - 1);
+  limit = limit < PRIME_SIEVE_MAX_BASE_PRIME ? limit : PRIME_SIEVE_MAX_BASE_PRIME;
+  vector<uint64_t> base_primes;
+  BasePrimes(limit, &base_primes);
+  // (limit + 1)^2 is the smallest number which may slip through the sieve
+  uint64_t proven = limit < PRIME_SIEVE_MAX_BASE_PRIME ? end : (limit + 1) * (limit + 1);
+
+  uint64_t num_segments = ((end - first + 1) / 2 + PRIME_SIEVE_SEGMENT_SIZE - 1) /
+                          PRIME_SIEVE_SEGMENT_SIZE;
+  // segments sieved in parallel before their primes are handed over
+  int64_t batch = 4 * omp_get_max_threads();
+  vector<vector<uint64_t>> segment_primes(batch);
+
+  for (uint64_t batch_first = 0; batch_first < num_segments; batch_first += batch) {
+    int64_t batch_size = num_segments - batch_first < batch ? num_segments - batch_first : batch;
+
+    #pragma omp parallel
+    {
+      vector<uint8_t> sieve;
+
+      #pragma omp for schedule(dynamic)
+      for (int64_t s = 0; s < batch_size; ++s) {
+        uint64_t low = first + 2 * PRIME_SIEVE_SEGMENT_SIZE * (batch_first + s);
+        uint64_t span = 2 * PRIME_SIEVE_SEGMENT_SIZE;
+        uint64_t high = end - low > span ? low + span : end;
+        segment_primes[s].clear();
+        SieveSegment(low, high, base_primes, proven, &sieve, &segment_primes[s]);
+      }
+    }
+
+    for (int64_t s = 0; s < batch_size; ++s) {
+      if (!segment_primes[s].empty()) {
+        callback(segment_primes[s].data(), segment_primes[s].size());
+      }
+    }
+  }
+}
+
+void FindPrimes(const uint64_t begin, const uint64_t end, vector<uint64_t>* primes) {
+  FindPrimes(begin, end, [primes](const uint64_t* segment, size_t count) {
+    primes->insert(primes->end(), segment, segment + count);
+  });
+}
+
+uint64_t CountPrimes(const uint64_t begin, const uint64_t end) {
+  uint64_t count = 0;
+  FindPrimes(begin, end, [&count](const uint64_t* segment, size_t segment_count) {
+    count += segment_count;
+  });
+  return count;
+}
+
+} // namespace para
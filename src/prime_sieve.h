@@ -0,0 +1,54 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// Find all primes in a range with a segmented sieve of Eratosthenes.
+
+#ifndef PRIME_SIEVE_H_
+#define PRIME_SIEVE_H_
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <omp.h>
+
+#include "miller_robin.h"
+
+using std::vector;
+
+namespace para {
+
+// Odd numbers per segment, one byte each, so a segment stays in L2 cache.
+const size_t PRIME_SIEVE_SEGMENT_SIZE = 131072;
+
+// Largest prime used to sieve. Ranges above its square keep the numbers
+// without a factor up to it and test them with MillerRobinDeterministic().
+const uint64_t PRIME_SIEVE_MAX_BASE_PRIME = 1 << 20;
+
+// Called with the primes of one segment, in ascending order.
+typedef std::function<void(const uint64_t* primes, size_t count)> PrimeCallback;
+
+// \brief Find all primes in [begin, end).
+//
+// The range is cut into segments of PRIME_SIEVE_SEGMENT_SIZE odd numbers, and
+// OpenMP threads sieve a few segments each at a time. The primes are handed
+// to callback segment by segment in ascending order, so memory doesn't grow
+// with the range.
+//
+// \param begin first number of the range
+// \param end one past the last number of the range
+// \param callback receives the primes
+void FindPrimes(const uint64_t begin, const uint64_t end, const PrimeCallback& callback);
+
+// \brief Find all primes in [begin, end) and append them to primes in
+// ascending order.
+void FindPrimes(const uint64_t begin, const uint64_t end, vector<uint64_t>* primes);
+
+// \return number of primes in [begin, end)
+uint64_t CountPrimes(const uint64_t begin, const uint64_t end);
+
+} // namespace para
+
+
+#endif
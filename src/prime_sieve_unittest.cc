@@ -0,0 +1,51 @@
+// MIT License
+//
+// Copyright (c) 2020 xiw
+// \author wang xi
+// Prime sieve unit test
+
+#include <cstdio>
+#include <cassert>
+
+#include "prime_sieve.h"
+
+// primes in [begin, end) by the deterministic Miller-Robin test
+static vector<uint64_t> SlowPrimes(uint64_t begin, uint64_t end) {
+  vector<uint64_t> primes;
+  for (uint64_t x = begin; x < end; ++x) {
+    if (para::MillerRobinDeterministic(x)) {
+      primes.emplace_back(x);
+    }
+  }
+  return primes;
+}
+
+void TestPrimeSieve() {
+  assert(para::CountPrimes(0, 1000000) == 78498);
+  assert(para::CountPrimes(0, 2000000) == 148933);
+  assert(para::CountPrimes(7, 8) == 1);
+  assert(para::CountPrimes(8, 8) == 0);
+  printf("case #1 pass\n");
+
+  uint64_t ranges[][2] = {{0, 100}, {2, 3}, {90, 1000}, {999983, 1300000},
+                          {1000000000000000000ULL, 1000000000000010000ULL},
+                          {18446744073709541615ULL, 18446744073709551615ULL}};
+  for (auto& range : ranges) {
+    vector<uint64_t> primes;
+    para::FindPrimes(range[0], range[1], &primes);
+    assert(primes == SlowPrimes(range[0], range[1]));
+  }
+  printf("case #2 pass\n");
+
+  // segments arrive in ascending order
+  uint64_t last = 0, count = 0;
+  para::FindPrimes(4000000000ULL, 4010000000ULL, [&](const uint64_t* primes, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      assert(primes[i] > last);
+      last = primes[i];
+    }
+    count += n;
+  });
+  assert(count == para::CountPrimes(4000000000ULL, 4010000000ULL));
+  printf("case #3 pass\n");
+}
@@ -110,13 +110,8 @@ void WordCounter::WorkerLarge(const string& in_file, int single_size, int id, in
   std::unordered_map<string, int> word_dict;
   ProcessText(text_buf, &word_dict);
 
-  vector<char> words;
-  vector<int> counts;
-  Map2Vec(word_dict, &words, &counts);
-
   // send response back to master
-  ::MPI_Send(words.data(), words.size(), MPI_CHAR, master_id, PUT_RESULT, comm);
-  ::MPI_Send(counts.data(), counts.size(), MPI_INT, master_id, PUT_RESULT, comm);
+  GatherWordDict(word_dict, master_id, comm, nullptr);
 }
 
 void WordCounter::MasterLarge(const string& in_file, int single_size, const string& out_file, int num_processes, const ::MPI_Comm comm) {
@@ -144,41 +139,12 @@ void WordCounter::MasterLarge(const string& in_file, int single_size, const stri
   std::unordered_map<string, int> word_dict;
   ProcessText(text_buf, &word_dict);
 
-  // receive response
-  int terminated_processes = 0;
-  while (num_processes - 1 > terminated_processes) {
-    ::MPI_Status status;
-
-    ::MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
-    int count = -1;
-    MPI_Get_count(&status, MPI_CHAR, &count);
-    vector<char> words(count+1, 0);
-    ::MPI_Recv(words.data(), count, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-
-    ::MPI_Probe(status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-    MPI_Get_count(&status, MPI_INT, &count);
-    vector<int> counts(count, 0);
-
-    ::MPI_Recv(counts.data(), count, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-    int j = 0;
-    for(int i = 0; i < counts.size(); ++i){
-      string word(words.data() + j);
-      
-      if (word_dict.find(word) == word_dict.end()) {
-        word_dict[word] = 0;
-      }
-      word_dict[word] += counts[i];
-
-      while(j < words.size() && 0 != words[j]){
-        ++j;
-      }
-      ++j;
-    }
-    terminated_processes++;
-  }
+  // collect the results of all processes
+  std::unordered_map<string, int> merged_dict;
+  GatherWordDict(word_dict, 0, comm, &merged_dict);
 
   f = ::fopen(out_file.c_str(), "w");
-  for(auto i : word_dict){
+  for(auto i : merged_dict){
     string s(i.first);
     s.append(" ");
     char count_buf[10] = {0};
@@ -210,16 +176,8 @@ void WordCounter::WorkerSmall(const vector<string> files, int start_file_num, in
     ProcessText(text_buf, &word_dict);
   }
 
-  vector<char> words;
-  vector<int> counts;
-  
-  Map2Vec(word_dict, &words, &counts);
-  for(auto i : counts){
-    printf("%d\n", i);
-  }
   // send response back to master
-  ::MPI_Send(words.data(), words.size(), MPI_CHAR, master_id, PUT_RESULT, comm);
-  ::MPI_Send(counts.data(), counts.size(), MPI_INT, master_id, PUT_RESULT, comm);  
+  GatherWordDict(word_dict, master_id, comm, nullptr);
 }
 
 void WordCounter::MasterSmall(const vector<string> files, int start_file_num, int end_file_num, const string& out_file, int num_processes, const ::MPI_Comm comm){
@@ -243,41 +201,12 @@ void WordCounter::MasterSmall(const vector<string> files, int start_file_num, in
   }
 
 
-  // receive response
-  int terminated_processes = 0;
-  while (num_processes-1 > terminated_processes){
-    ::MPI_Status status;
-    //printf("start to receive\n");
-    ::MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
-    int count = -1;
-    MPI_Get_count(&status, MPI_CHAR, &count);
-    vector<char> words(count+1, 0);
-    ::MPI_Recv(words.data(), count, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-    //printf("succeeded receiving\n");
-
-    ::MPI_Probe(status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-    MPI_Get_count(&status, MPI_INT, &count);
-    vector<int> counts(count, 0);
-
-    ::MPI_Recv(counts.data(), count, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-    int j = 0;
-    for(int i = 0; i < counts.size(); ++i){
-      string word(words.data() + j);
-      if (word_dict.find(word) == word_dict.end()) {
-        word_dict[word] = 0;
-      }
-      word_dict[word] += counts[i];
-
-      while(j < words.size() && 0 != words[j]){
-        ++j;
-      }
-      ++j;
-    }
-    terminated_processes++;
-  } 
+  // collect the results of all processes
+  std::unordered_map<string, int> merged_dict;
+  GatherWordDict(word_dict, 0, comm, &merged_dict);
 
   auto f = ::fopen(out_file.c_str(), "w");
-  for(auto i : word_dict){
+  for(auto i : merged_dict){
     string s(i.first);
     s.append(" ");
     char count_buf[10] = {0};
@@ -290,6 +219,64 @@ void WordCounter::MasterSmall(const vector<string> files, int start_file_num, in
   ::fclose(f);
 }
 
+void WordCounter::GatherWordDict(const std::unordered_map<string, int>& word_dict, int master_id,
+                                 const ::MPI_Comm& comm, std::unordered_map<string, int>* merged_dict) {
+  int id = -1;
+  ::MPI_Comm_rank(comm, &id);
+  int num_processes = -1;
+  ::MPI_Comm_size(comm, &num_processes);
+
+  vector<char> words;
+  vector<int> counts;
+  Map2Vec(word_dict, &words, &counts);
+
+  // sizes[2*p]: length of words, sizes[2*p+1]: length of counts of process p
+  int local_sizes[2] = {static_cast<int>(words.size()), static_cast<int>(counts.size())};
+  vector<int> sizes(2 * num_processes, 0);
+  para::Gather(local_sizes, 2, MPI_INT, sizes.data(), 2, MPI_INT, master_id, comm);
+
+  vector<int> words_sizes(num_processes, 0), words_displs(num_processes, 0);
+  vector<int> counts_sizes(num_processes, 0), counts_displs(num_processes, 0);
+  int total_words = 0, total_counts = 0;
+  if (id == master_id) {
+    for (int p = 0; p < num_processes; ++p) {
+      words_sizes[p] = sizes[2 * p];
+      words_displs[p] = total_words;
+      total_words += words_sizes[p];
+
+      counts_sizes[p] = sizes[2 * p + 1];
+      counts_displs[p] = total_counts;
+      total_counts += counts_sizes[p];
+    }
+  }
+
+  vector<char> all_words(total_words, 0);
+  vector<int> all_counts(total_counts, 0);
+  para::Gatherv(words.data(), words.size(), MPI_CHAR, all_words.data(), words_sizes.data(),
+                words_displs.data(), MPI_CHAR, master_id, comm);
+  para::Gatherv(counts.data(), counts.size(), MPI_INT, all_counts.data(), counts_sizes.data(),
+                counts_displs.data(), MPI_INT, master_id, comm);
+
+  if (id != master_id) {
+    return;
+  }
+
+  int j = 0;
+  for(int i = 0; i < all_counts.size(); ++i){
+    string word(all_words.data() + j);
+
+    if (merged_dict->find(word) == merged_dict->end()) {
+      (*merged_dict)[word] = 0;
+    }
+    (*merged_dict)[word] += all_counts[i];
+
+    while(j < all_words.size() && 0 != all_words[j]){
+      ++j;
+    }
+    ++j;
+  }
+}
+
 inline bool WordCounter::IsAlpha(const char& c) {
   if (c == '\'' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
     return true;
@@ -22,6 +22,8 @@
 
 #include <mpi.h>
 
+#include "all_gather.h"
+
 using std::string;
 using std::vector;
 
@@ -72,6 +74,14 @@ class WordCounter {
   void MasterSmall(const vector<string> files, int start_file_num, int end_file_num, const string& out_file, int num_processes, const ::MPI_Comm comm);
 
 
+  // \brief Gather the word counts of all processes to master and merge them.
+  // Every process calls it with its own word_dict. Serialized word lists have
+  // a different length on every process, they are collected by para::Gatherv.
+  //
+  // \param merged_dict merged word counts, only used on master
+  void GatherWordDict(const std::unordered_map<string, int>& word_dict, int master_id,
+                      const ::MPI_Comm& comm, std::unordered_map<string, int>* merged_dict);
+
   void ProcessText(const vector<char>& buf, std::unordered_map<string, int>* word_dict);
 
   void Map2Vec(const std::unordered_map<string, int>& word_dict, vector<char>* words, vector<int>* counts);
@@ -7,7 +7,18 @@
 #include <cstdio>
 
 extern void TestMillerRobin();
+extern void TestMillerRobinBatch();
+extern void TestFastExponential();
+extern void TestMillerRobinDeterministic();
+extern void TestPrimeSieve();
 extern void TestPageRank();
+extern void TestPageRankEdgeList();
+extern void TestPageRankThreads();
+extern void TestPageRankCSRFile();
+extern void TestPageRankIndexTypes();
+extern void TestPageRankGaussSeidel();
+extern void TestPageRankOrdering();
+extern void TestPageRankHubs();
 extern void TestParallelQuickSort();
 
 int main(int argc, char const *argv[]) {
@@ -17,10 +28,54 @@ int main(int argc, char const *argv[]) {
   TestMillerRobin();
   printf("\n");
 
+  printf("Test FastExponential...\n");
+  TestFastExponential();
+  printf("\n");
+
+  printf("Test MillerRobinBatch...\n");
+  TestMillerRobinBatch();
+  printf("\n");
+
+  printf("Test MillerRobinDeterministic...\n");
+  TestMillerRobinDeterministic();
+  printf("\n");
+
+  printf("Test FindPrimes...\n");
+  TestPrimeSieve();
+  printf("\n");
+
   printf("Test PageRanker::PageRank...\n");
   TestPageRank();
   printf("\n");
 
+  printf("Test PageRanker::PageRank from an edge list file...\n");
+  TestPageRankEdgeList();
+  printf("\n");
+
+  printf("Test PageRanker::PageRank with 1 and 4 threads...\n");
+  TestPageRankThreads();
+  printf("\n");
+
+  printf("Test PageRanker::PageRank on a mapped CSR file...\n");
+  TestPageRankCSRFile();
+  printf("\n");
+
+  printf("Test PageRanker::PageRank with 64-bit indices...\n");
+  TestPageRankIndexTypes();
+  printf("\n");
+
+  printf("Test PageRanker::PageRank with Gauss-Seidel...\n");
+  TestPageRankGaussSeidel();
+  printf("\n");
+
+  printf("Test PageRanker::PageRank on reordered nodes...\n");
+  TestPageRankOrdering();
+  printf("\n");
+
+  printf("Test PageRanker::PageRank on a graph with hubs...\n");
+  TestPageRankHubs();
+  printf("\n");
+
   printf("Test ParallelQuickSort...\n");
   TestParallelQuickSort();
   printf("\n");